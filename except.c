@@ -24,189 +24,3205 @@
   DEALINGS IN THE SOFTWARE.
  */
 
+// For pthread_getattr_np and the registers in ucontext_t.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "except.h"
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+#include <threads.h>
+#endif
+
+#if defined(LIBEXCEPT_THREAD_AWARE) && defined(__unix__)
+#include <unistd.h>
+#endif
+
+#ifdef LIBEXCEPT_BACKTRACE
+#include <execinfo.h>
+#endif
+
+#ifdef LIBEXCEPT_RECORDER
+#include "except_recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(LIBEXCEPT_RECORDER) && defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+#include <errno.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define __LIBEXCEPT_DEFINE_BUILTIN(type, id)                                                       \
+    __LIBEXCEPT_DEFINE_DESCRIPTOR(id) = {.name = #type, .base = NULL, .depth = 0};
+__LIBEXCEPT_BUILTIN_TYPES(__LIBEXCEPT_DEFINE_BUILTIN)
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+LIBEXCEPT_DEFINE_TYPE(aggregate_error_t);
+#endif
+
+LIBEXCEPT_DEFINE_TYPE(arithmetic_error_t);
+
+#ifdef LIBEXCEPT_SIGNAL_AWARE
+LIBEXCEPT_DEFINE_TYPE(illegal_instruction_error_t);
+LIBEXCEPT_DEFINE_TYPE(stack_corruption_error_t);
+LIBEXCEPT_DEFINE_TYPE(memory_error_t);
+LIBEXCEPT_DEFINE_SUBTYPE(access_violation_t, memory_error_t);
+LIBEXCEPT_DEFINE_SUBTYPE(misaligned_access_error_t, memory_error_t);
+LIBEXCEPT_DEFINE_SUBTYPE(mapped_io_error_t, memory_error_t);
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+LIBEXCEPT_DEFINE_TYPE(deadline_exceeded_t);
+#endif
+
+__LIBEXCEPT_THREAD_LOCAL __libexcept_state __libexcept_thread;
+
+#ifdef LIBEXCEPT_FIBERS
+__LIBEXCEPT_THREAD_LOCAL __libexcept_state* __libexcept_fiber;
+
+#ifdef LIBEXCEPT_REGIONS
+static void __libexcept_free_regions(__libexcept_state* state);
+#endif
+
+libexcept_fiber_t* libexcept_create_fiber()
+{
+    __libexcept_state* state =
+        aligned_alloc(_Alignof(__libexcept_state), sizeof(__libexcept_state));
+    if (state != NULL)
+    {
+        memset(state, 0, sizeof(__libexcept_state));
+    }
+    return (libexcept_fiber_t*)state;
+}
+
+void libexcept_destroy_fiber(libexcept_fiber_t* fiber)
+{
+    __libexcept_state* state = (__libexcept_state*)fiber;
+    if (state == NULL)
+    {
+        return;
+    }
+
+    // Exceptions still being handled when a fiber is abandoned are released with it.
+    for (__libexcept_record* record = state->current; record != NULL; record = record->previous)
+    {
+        free(record->formatted);
+    }
+    while (state->chunks != NULL)
+    {
+        __libexcept_chunk* next = state->chunks->next;
+        free(state->chunks);
+        state->chunks = next;
+    }
+#ifdef LIBEXCEPT_REGIONS
+    __libexcept_free_regions(state);
+#endif
+    free(state);
+}
+
+libexcept_fiber_t* libexcept_get_fiber()
+{
+    return (libexcept_fiber_t*)__libexcept_fiber;
+}
+
+void libexcept_set_fiber(libexcept_fiber_t* fiber)
+{
+    __libexcept_fiber = (__libexcept_state*)fiber;
+}
+
+libexcept_fiber_t* libexcept_swap_fiber(libexcept_fiber_t* fiber)
+{
+    libexcept_fiber_t* previous = (libexcept_fiber_t*)__libexcept_fiber;
+    __libexcept_fiber = (__libexcept_state*)fiber;
+    return previous;
+}
+#endif
+
+#ifdef LIBEXCEPT_STATISTICS
+/*
+  Every thread that has counted anything is linked into a registry, so that a snapshot can read its
+  counters. When a thread exits its counters are added to the retired totals and it is unlinked.
+ */
+
+static __libexcept_counters* __libexcept_registry;
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static libexcept_statistics_t __libexcept_retired;
+static mtx_t __libexcept_registry_lock;
+static tss_t __libexcept_registry_key;
+static once_flag __libexcept_registry_once = ONCE_FLAG_INIT;
+#endif
+
+static void __libexcept_add(_Atomic unsigned long long* counter)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+static unsigned long long __libexcept_load(_Atomic unsigned long long* counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void __libexcept_merge_type(libexcept_statistics_t* statistics,
+                                   const libexcept_type_t* type,
+                                   unsigned long long throws,
+                                   unsigned long long catches)
+{
+    libexcept_type_statistics_t* entry = &statistics->untracked;
+
+    if (type != NULL)
+    {
+        for (int i = 0; i < LIBEXCEPT_STATISTICS_TYPES; i++)
+        {
+            if (statistics->types[i].type == type || statistics->types[i].type == NULL)
+            {
+                entry = &statistics->types[i];
+                entry->type = type;
+                break;
+            }
+        }
+    }
+
+    entry->throws += throws;
+    entry->catches += catches;
+}
+
+static void __libexcept_merge(libexcept_statistics_t* statistics, __libexcept_counters* counters)
+{
+    statistics->throws += __libexcept_load(&counters->throws);
+    statistics->catches += __libexcept_load(&counters->catches);
+    statistics->rethrows += __libexcept_load(&counters->rethrows);
+    statistics->unhandled += __libexcept_load(&counters->unhandled);
+    statistics->unexpected += __libexcept_load(&counters->unexpected);
+
+    int max_try_depth = atomic_load_explicit(&counters->max_try_depth, memory_order_relaxed);
+    if (max_try_depth > statistics->max_try_depth)
+    {
+        statistics->max_try_depth = max_try_depth;
+    }
+
+    for (int i = 0; i < LIBEXCEPT_STATISTICS_TYPES; i++)
+    {
+        __libexcept_type_counters* entry = &counters->types[i];
+        const libexcept_type_t* type = atomic_load_explicit(&entry->type, memory_order_relaxed);
+        if (type != NULL)
+        {
+            __libexcept_merge_type(statistics, type, __libexcept_load(&entry->throws),
+                                   __libexcept_load(&entry->catches));
+        }
+    }
+
+    __libexcept_merge_type(statistics, NULL, __libexcept_load(&counters->untracked.throws),
+                           __libexcept_load(&counters->untracked.catches));
+}
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static void __libexcept_retire(void* data)
+{
+    __libexcept_counters* counters = data;
+
+    mtx_lock(&__libexcept_registry_lock);
+    __libexcept_merge(&__libexcept_retired, counters);
+    *counters->previous = counters->next;
+    if (counters->next != NULL)
+    {
+        counters->next->previous = counters->previous;
+    }
+    mtx_unlock(&__libexcept_registry_lock);
+}
+
+static void __libexcept_init_registry()
+{
+    mtx_init(&__libexcept_registry_lock, mtx_plain);
+    tss_create(&__libexcept_registry_key, __libexcept_retire);
+}
+#endif
+
+static __libexcept_counters* __libexcept_statistics()
+{
+    __libexcept_counters* counters = &__libexcept_thread.counters;
+
+    if (!counters->registered)
+    {
+        counters->registered = 1;
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+        call_once(&__libexcept_registry_once, __libexcept_init_registry);
+        mtx_lock(&__libexcept_registry_lock);
+#endif
+        counters->next = __libexcept_registry;
+        counters->previous = &__libexcept_registry;
+        if (__libexcept_registry != NULL)
+        {
+            __libexcept_registry->previous = &counters->next;
+        }
+        __libexcept_registry = counters;
+#ifdef LIBEXCEPT_THREAD_AWARE
+        mtx_unlock(&__libexcept_registry_lock);
+        tss_set(__libexcept_registry_key, counters);
+#endif
+    }
+
+    return counters;
+}
+
+/*
+  Returns the counters of type in the table of the current thread, which is searched by linear
+  probing. A NULL type marks a free entry.
+ */
+static __libexcept_type_counters* __libexcept_type_statistics(const libexcept_type_t* type)
+{
+    __libexcept_counters* counters = __libexcept_statistics();
+    size_t start = ((size_t)type / sizeof(libexcept_type_t)) % LIBEXCEPT_STATISTICS_TYPES;
+
+    for (size_t i = 0; i < LIBEXCEPT_STATISTICS_TYPES; i++)
+    {
+        __libexcept_type_counters* entry =
+            &counters->types[(start + i) % LIBEXCEPT_STATISTICS_TYPES];
+        const libexcept_type_t* current = atomic_load_explicit(&entry->type, memory_order_relaxed);
+
+        if (current == type)
+        {
+            return entry;
+        }
+
+        if (current == NULL)
+        {
+            atomic_store_explicit(&entry->type, type, memory_order_relaxed);
+            return entry;
+        }
+    }
+
+    return &counters->untracked;
+}
+
+void __libexcept_count_try_depth()
+{
+    atomic_store_explicit(&__libexcept_statistics()->max_try_depth, __LIBEXCEPT_TASK.try_depth,
+                          memory_order_relaxed);
+}
+
+void libexcept_get_statistics(libexcept_statistics_t* statistics)
+{
+    *statistics = (libexcept_statistics_t){0};
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    call_once(&__libexcept_registry_once, __libexcept_init_registry);
+    mtx_lock(&__libexcept_registry_lock);
+    *statistics = __libexcept_retired;
+#endif
+
+    for (__libexcept_counters* counters = __libexcept_registry; counters != NULL;
+         counters = counters->next)
+    {
+        __libexcept_merge(statistics, counters);
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    mtx_unlock(&__libexcept_registry_lock);
+#endif
+}
+
+#define __LIBEXCEPT_COUNT(counter) __libexcept_add(&__libexcept_statistics()->counter)
+#define __LIBEXCEPT_COUNT_TYPE(type, counter)                                                      \
+    __libexcept_add(&__libexcept_type_statistics(type)->counter)
+#else
+#define __LIBEXCEPT_COUNT(counter)            (void)0
+#define __LIBEXCEPT_COUNT_TYPE(type, counter) (void)0
+#endif
+
+static void __libexcept_set_current(__libexcept_record* record)
+{
+    __LIBEXCEPT_TASK.current = record;
+    if (record != NULL)
+    {
+        __LIBEXCEPT_TASK.depth = record->type->depth;
+        for (const libexcept_type_t* type = record->type; type != NULL; type = type->base)
+        {
+            __LIBEXCEPT_TASK.display[type->depth] = type;
+        }
+    }
+}
+
+#ifdef LIBEXCEPT_SIGNAL_AWARE
+#include <signal.h>
+#include <sys/stat.h>
+#include <ucontext.h>
+
+#ifdef LIBEXCEPT_DEADLINES
+#define __LIBEXCEPT_DEADLINE_SIGNAL SIGRTMIN
+
+static uint64_t __libexcept_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+#endif
+
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+/*
+  Alternate signal stacks are mapped a chunk at a time, each with a guard page below it, and handed
+  out to threads as they need one. A thread gives its stack back to the pool when it exits. Along
+  with its stack, every thread remembers the guard page of its own stack, so that overflowing it can
+  be told apart from other access violations.
+ */
+
+#define __LIBEXCEPT_SIGNAL_STACK_SIZE   (64 * 1024)
+#define __LIBEXCEPT_SIGNAL_STACKS_CHUNK 32
+
+// The gap in pages that Linux keeps below a growing stack by default (stack_guard_gap).
+#define __LIBEXCEPT_STACK_GUARD_GAP 256
+
+typedef struct __libexcept_signal_stack
+{
+    char* base;
+    size_t size;
+    char* guard;
+    char* guard_end;
+    struct __libexcept_signal_stack* next;
+} __libexcept_signal_stack;
+
+_Atomic(int) __libexcept_signal_stacks_wanted;
+static __libexcept_signal_stack* __libexcept_free_signal_stacks;
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static mtx_t __libexcept_signal_stacks_lock;
+static tss_t __libexcept_signal_stack_key;
+static once_flag __libexcept_signal_stacks_once = ONCE_FLAG_INIT;
+
+static void __libexcept_release_signal_stack(void* data)
+{
+    __libexcept_signal_stack* stack = data;
+
+    stack_t disabled = {.ss_flags = SS_DISABLE};
+    sigaltstack(&disabled, NULL);
+    __libexcept_thread.signal_stack = NULL;
+
+    mtx_lock(&__libexcept_signal_stacks_lock);
+    stack->next = __libexcept_free_signal_stacks;
+    __libexcept_free_signal_stacks = stack;
+    mtx_unlock(&__libexcept_signal_stacks_lock);
+}
+
+static void __libexcept_init_signal_stacks()
+{
+    mtx_init(&__libexcept_signal_stacks_lock, mtx_plain);
+    tss_create(&__libexcept_signal_stack_key, __libexcept_release_signal_stack);
+}
+#endif
+
+static void __libexcept_map_signal_stacks()
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = __LIBEXCEPT_SIGNAL_STACK_SIZE;
+
+#ifdef _SC_MINSIGSTKSZ
+    // The kernel puts the signal frame on the stack first, whose size depends on the processor.
+    long frame = sysconf(_SC_MINSIGSTKSZ);
+    if (frame > 0)
+    {
+        size += (size_t)frame;
+    }
+#endif
+
+    size = (size + page - 1) / page * page;
+    size_t slot = page + size;
+
+    __libexcept_signal_stack* stacks =
+        malloc(sizeof(__libexcept_signal_stack) * __LIBEXCEPT_SIGNAL_STACKS_CHUNK);
+    if (stacks == NULL)
+    {
+        return;
+    }
+
+    // Only the pages that a handler ends up using are backed by memory.
+    char* memory = mmap(NULL, slot * __LIBEXCEPT_SIGNAL_STACKS_CHUNK, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        free(stacks);
+        return;
+    }
+
+    // Without its guard pages an overflowing signal handler would run into the next stack.
+    for (int i = 0; i < __LIBEXCEPT_SIGNAL_STACKS_CHUNK; i++)
+    {
+        if (mprotect(memory + slot * i, page, PROT_NONE) != 0)
+        {
+            munmap(memory, slot * __LIBEXCEPT_SIGNAL_STACKS_CHUNK);
+            free(stacks);
+            return;
+        }
+    }
+
+    for (int i = 0; i < __LIBEXCEPT_SIGNAL_STACKS_CHUNK; i++)
+    {
+        stacks[i].base = memory + slot * i + page;
+        stacks[i].size = size;
+        stacks[i].next = __libexcept_free_signal_stacks;
+        __libexcept_free_signal_stacks = &stacks[i];
+    }
+}
+
+static void __libexcept_find_stack_guard(__libexcept_signal_stack* stack)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    void* address = NULL;
+    size_t size = 0;
+    size_t guard_size = 0;
+
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) == 0)
+    {
+        pthread_attr_getstack(&attributes, &address, &size);
+        pthread_attr_getguardsize(&attributes, &guard_size);
+        pthread_attr_destroy(&attributes);
+    }
+
+    /*
+      The main thread reports no guard page. Its stack is reported down to the limit it may grow to,
+      below which the kernel keeps a gap that faults instead of mapping more pages.
+     */
+    if (guard_size < page)
+    {
+        guard_size = page * __LIBEXCEPT_STACK_GUARD_GAP;
+    }
+
+    stack->guard = address != NULL ? (char*)address - guard_size : NULL;
+    stack->guard_end = address;
+}
+
+void __libexcept_claim_signal_stack()
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    call_once(&__libexcept_signal_stacks_once, __libexcept_init_signal_stacks);
+    mtx_lock(&__libexcept_signal_stacks_lock);
+#endif
+
+    if (__libexcept_free_signal_stacks == NULL)
+    {
+        __libexcept_map_signal_stacks();
+    }
+
+    __libexcept_signal_stack* stack = __libexcept_free_signal_stacks;
+    if (stack != NULL)
+    {
+        __libexcept_free_signal_stacks = stack->next;
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    mtx_unlock(&__libexcept_signal_stacks_lock);
+#endif
+
+    // Without a stack the thread tries again at its next try block.
+    if (stack == NULL)
+    {
+        return;
+    }
+
+    stack_t alternate = {
+        .ss_sp = stack->base,
+        .ss_size = stack->size,
+        .ss_flags = 0,
+    };
+    sigaltstack(&alternate, NULL);
+    __libexcept_find_stack_guard(stack);
+
+    __libexcept_thread.signal_stack = stack;
+#ifdef LIBEXCEPT_THREAD_AWARE
+    tss_set(__libexcept_signal_stack_key, stack);
+#endif
+}
+
+static void* __libexcept_signal_pc(ucontext_t* context)
+{
+#if defined(__x86_64__)
+    return (void*)context->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (void*)context->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (void*)context->uc_mcontext.pc;
+#else
+    (void)context;
+    return NULL;
+#endif
+}
+
+static int __libexcept_is_stack_overflow(void* address)
+{
+    __libexcept_signal_stack* stack = __libexcept_thread.signal_stack;
+    return stack != NULL && (char*)address >= stack->guard && (char*)address < stack->guard_end;
+}
+#endif
+
+/*
+  Registered mappings are kept in a fixed table, since the signal handler can neither take a lock
+  nor follow a list that is being changed. A slot is claimed through its flag and only becomes
+  visible to the handler once its base is stored, after the rest of it has been filled in.
+ */
+
+typedef struct
+{
+    _Atomic(int) claimed;
+    _Atomic(char*) base;
+    size_t length;
+    dev_t device;
+    ino_t inode;
+    off_t offset;
+} __libexcept_mapping;
+
+static __libexcept_mapping __libexcept_mappings[LIBEXCEPT_MAX_MAPPINGS];
+
+int libexcept_register_mapping(const void* base, size_t length, int fd, off_t offset)
+{
+    struct stat status;
+    if (base == NULL || fstat(fd, &status) != 0)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < LIBEXCEPT_MAX_MAPPINGS; i++)
+    {
+        __libexcept_mapping* mapping = &__libexcept_mappings[i];
+        int claimed = 0;
+        if (atomic_compare_exchange_strong(&mapping->claimed, &claimed, 1))
+        {
+            mapping->length = length;
+            mapping->device = status.st_dev;
+            mapping->inode = status.st_ino;
+            mapping->offset = offset;
+            atomic_store_explicit(&mapping->base, (char*)base, memory_order_release);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void libexcept_unregister_mapping(const void* base)
+{
+    for (int i = 0; i < LIBEXCEPT_MAX_MAPPINGS; i++)
+    {
+        __libexcept_mapping* mapping = &__libexcept_mappings[i];
+        if (atomic_load_explicit(&mapping->base, memory_order_relaxed) == base)
+        {
+            atomic_store_explicit(&mapping->base, NULL, memory_order_relaxed);
+            atomic_store_explicit(&mapping->claimed, 0, memory_order_release);
+            return;
+        }
+    }
+}
+
+static int __libexcept_find_mapping(mapped_io_error_t* error)
+{
+    char* address = error->address;
+
+    for (int i = 0; i < LIBEXCEPT_MAX_MAPPINGS; i++)
+    {
+        __libexcept_mapping* mapping = &__libexcept_mappings[i];
+        char* base = atomic_load_explicit(&mapping->base, memory_order_acquire);
+        if (base != NULL && address >= base && address < base + mapping->length)
+        {
+            error->device = mapping->device;
+            error->inode = mapping->inode;
+            error->offset = mapping->offset + (off_t)(address - base);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void __libexcept_handle_signal(int signal, siginfo_t* info, void* context)
+{
+#ifdef LIBEXCEPT_DEADLINES
+    // Real-time signals are not constants, so this can not be a case below. The signal may
+    // interrupt libexcept itself, so the exception is only thrown at the next poll of the thread.
+    // It may also have been sent just before the deadline was disarmed or moved.
+    if (signal == __LIBEXCEPT_DEADLINE_SIGNAL)
+    {
+        uint64_t deadline = __libexcept_thread.deadline;
+        if (deadline != 0 && __libexcept_now() >= deadline)
+        {
+            __libexcept_thread.deadline_expired = 1;
+        }
+        return;
+    }
+#endif
+
+    // Try blocks do not save the signal mask, so the mask that was active before the signal was
+    // delivered has to be restored here. Otherwise the signal would remain blocked after the jump.
+    sigprocmask(SIG_SETMASK, &((ucontext_t*)context)->uc_sigmask, NULL);
+
+    switch (signal)
+    {
+    case SIGFPE: {
+        arithmetic_error_t error = {
+            .pc = info->si_addr,
+        };
+
+        switch (info->si_code)
+        {
+        case FPE_INTDIV:
+            error.message = "Integer division by zero.";
+            break;
+        case FPE_INTOVF:
+            error.message = "Integer overflow.";
+            break;
+        case FPE_FLTDIV:
+            error.message = "Floating point division by zero.";
+            break;
+        case FPE_FLTOVF:
+            error.message = "Floating point overflow.";
+            break;
+        case FPE_FLTUND:
+            error.message = "Floating point underflow.";
+            break;
+        case FPE_FLTRES:
+            error.message = "Floating point inexact result.";
+            break;
+        case FPE_FLTINV:
+            error.message = "Invalid floating point operation.";
+            break;
+        case FPE_FLTSUB:
+            error.message = "Subscript out of range.";
+            break;
+        default:
+            error.message = "Unknown arithmetic exception.";
+            break;
+        }
+        throw(arithmetic_error_t, error);
+    }
+    case SIGBUS: {
+        if (info->si_code == BUS_ADRALN)
+        {
+            misaligned_access_error_t error = {
+                .message = "Invalid address alignment.",
+                .address = info->si_addr,
+            };
+            throw(misaligned_access_error_t, error);
+        }
+
+        mapped_io_error_t error = {
+            .message = "Mapped file could not be accessed.",
+            .address = info->si_addr,
+        };
+        if (__libexcept_find_mapping(&error))
+        {
+            throw(mapped_io_error_t, error);
+        }
+    }
+    // Falls through - any other bus error is reported like a segmentation fault.
+    case SIGSEGV: {
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+        if (__libexcept_is_stack_overflow(info->si_addr))
+        {
+            stack_corruption_error_t error = {
+                .message = "Stack overflow.",
+                .pc = __libexcept_signal_pc(context),
+            };
+            throw(stack_corruption_error_t, error);
+        }
+#endif
+        access_violation_t error = {
+            .message = "Access violation.",
+            .address = info->si_addr,
+        };
+        throw(access_violation_t, error);
+    }
+    case SIGILL: {
+        if (info->si_code == ILL_BADSTK)
+        {
+            stack_corruption_error_t error = {
+                .message = "Internal stack error.",
+                .pc = info->si_addr,
+            };
+            throw(stack_corruption_error_t, error);
+        }
+        else
+        {
+            illegal_instruction_error_t error = {
+                .message = "Illegal instruction.",
+                .pc = info->si_addr,
+            };
+            throw(illegal_instruction_error_t, error);
+        }
+    }
+
+    default:
+        abort();
+    }
+}
+
+void libexcept_enable_sigcatch()
+{
+#ifdef LIBEXCEPT_BACKTRACE
+    // The first call to backtrace may allocate memory, which should not happen in a signal handler.
+    void* frame;
+    backtrace(&frame, 1);
+#endif
+
+    struct sigaction sa;
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = __libexcept_handle_signal;
+    sigemptyset(&sa.sa_mask);
+
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+    // Threads without an alternate stack yet still handle signals on their own stack.
+    sa.sa_flags |= SA_ONSTACK;
+    atomic_store_explicit(&__libexcept_signal_stacks_wanted, 1, memory_order_relaxed);
+    if (__libexcept_thread.signal_stack == NULL)
+    {
+        __libexcept_claim_signal_stack();
+    }
+#endif
+
+    sigaction(SIGILL, &sa, NULL);
+    sigaction(SIGFPE, &sa, NULL);
+    sigaction(SIGSEGV, &sa, NULL);
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+void libexcept_disable_sigcatch()
+{
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+    atomic_store_explicit(&__libexcept_signal_stacks_wanted, 0, memory_order_relaxed);
+#endif
+
+    signal(SIGILL, SIG_DFL);
+    signal(SIGFPE, SIG_DFL);
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+}
+
+#ifdef LIBEXCEPT_DEADLINES
+/*
+  The timer of a thread sends its signal to that thread only. It is deleted when the thread exits.
+ */
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static tss_t __libexcept_deadline_key;
+static once_flag __libexcept_deadline_once = ONCE_FLAG_INIT;
+
+static void __libexcept_delete_timer(void* state)
+{
+    timer_delete(((__libexcept_state*)state)->deadline_timer);
+}
+#endif
+
+static void __libexcept_init_deadlines()
+{
+    // System calls are not restarted, so that a thread blocked in one gets to its next poll.
+    struct sigaction sa;
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = __libexcept_handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(__LIBEXCEPT_DEADLINE_SIGNAL, &sa, NULL);
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    tss_create(&__libexcept_deadline_key, __libexcept_delete_timer);
+#endif
+}
+
+static int __libexcept_create_timer(__libexcept_state* state)
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    call_once(&__libexcept_deadline_once, __libexcept_init_deadlines);
+#else
+    __libexcept_init_deadlines();
+#endif
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = __LIBEXCEPT_DEADLINE_SIGNAL;
+    event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+
+    if (timer_create(CLOCK_MONOTONIC, &event, &state->deadline_timer) != 0)
+    {
+        return 0;
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    tss_set(__libexcept_deadline_key, state);
+#endif
+    state->deadline_timer_created = 1;
+    return 1;
+}
+
+void __libexcept_set_deadline(uint64_t deadline)
+{
+    __libexcept_state* state = &__libexcept_thread;
+    state->deadline = deadline;
+
+    // A deadline of 0 disarms the timer, one that has already passed fires immediately.
+    struct itimerspec expiry = {
+        .it_value.tv_sec = (time_t)(deadline / 1000000000),
+        .it_value.tv_nsec = (long)(deadline % 1000000000),
+    };
+    timer_settime(state->deadline_timer, TIMER_ABSTIME, &expiry, NULL);
+}
+
+/*
+  Returns 0 or the errno value of creating the timer of the thread.
+ */
+static int __libexcept_arm_deadline(uint64_t nanoseconds)
+{
+    __libexcept_state* state = &__libexcept_thread;
+
+    if (!state->deadline_timer_created && !__libexcept_create_timer(state))
+    {
+        return errno;
+    }
+
+    // The timer is already armed for an earlier deadline, unless that one has fired.
+    uint64_t now = __libexcept_now();
+    uint64_t deadline = now + nanoseconds;
+    if (state->deadline == 0 || deadline < state->deadline)
+    {
+        __libexcept_set_deadline(deadline);
+    }
+    else if (state->deadline <= now)
+    {
+        __libexcept_set_deadline(state->deadline);
+    }
+    return 0;
+}
+
+void __libexcept_enter_deadline(uint64_t nanoseconds)
+{
+    (void)__LIBEXCEPT_POLL();
+
+    int error = __libexcept_arm_deadline(nanoseconds);
+    if (error != 0)
+    {
+        throw(int, error);
+    }
+}
+
+void __libexcept_expire()
+{
+    __libexcept_state* state = &__libexcept_thread;
+    state->deadline_expired = 0;
+
+    // The deadline stays in effect until the block it belongs to is done with its body.
+    deadline_exceeded_t error = {
+        .message = "Deadline exceeded.",
+        .deadline = state->deadline,
+    };
+    throw(deadline_exceeded_t, error);
+}
+#endif
+#endif
+
+#ifdef LIBEXCEPT_UNWIND
+/*
+  Only called by the handlers of other languages, such as catch (...) in C++, once they complete
+  without rethrowing the exception, which handles it. If they complete because another exception is
+  thrown out of them, the caught one is no longer current but lies below the new one, which then
+  releases it along with itself.
+ */
+static void __libexcept_delete_exception(_Unwind_Reason_Code reason,
+                                         struct _Unwind_Exception* exception)
+{
+    (void)reason;
+
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    __libexcept_record* caught =
+        (__libexcept_record*)((char*)exception - offsetof(__libexcept_record, unwind_exception));
+
+    if (state->current == caught)
+    {
+        // Nothing is being unwound while the handler runs.
+        state->unwinding = 0;
+        __libexcept_handled();
+        return;
+    }
+
+    __libexcept_record* record = state->current;
+    while (record->previous != caught)
+    {
+        record = record->previous;
+    }
+    record->previous = caught->previous;
+    record->top = caught->top;
+    record->end = caught->end;
+    free(caught->formatted);
+}
+
+static _Unwind_Reason_Code __libexcept_unwind_stop(int version,
+                                                   _Unwind_Action actions,
+                                                   _Unwind_Exception_Class exception_class,
+                                                   struct _Unwind_Exception* exception,
+                                                   struct _Unwind_Context* context,
+                                                   void* argument)
+{
+    (void)version;
+    (void)exception_class;
+    (void)exception;
+    (void)context;
+    (void)argument;
+
+    // Every try block lands while its frame is being unwound, so reaching the end of the stack
+    // means that no try block was found.
+    if (actions & _UA_END_OF_STACK)
+    {
+        __LIBEXCEPT_TASK.unwinding = 0;
+        __libexcept_unhandled();
+    }
+
+    return _URC_NO_REASON;
+}
+
+void __libexcept_land(void** buffer)
+{
+    if (__LIBEXCEPT_TASK.unwinding)
+    {
+        __LIBEXCEPT_TASK.unwinding = 0;
+        __LIBEXCEPT_LONGJMP(buffer, 1);
+    }
+
+    // Exceptions of other languages, such as those thrown by C++, just leave the try block.
+    __LIBEXCEPT_LEAVE();
+}
+#endif
+
+/*
+  Allocates size bytes from the arena, growing it first if needed. id is only used for reporting a
+  failure.
+ */
+static void* __libexcept_reserve(const libexcept_type_t* id, size_t size)
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    size = __LIBEXCEPT_ALIGN(size);
+
+    if ((size_t)(state->end - state->top) < size)
+    {
+        size_t chunk_size = size > LIBEXCEPT_ARENA_SIZE * 4 ? size : LIBEXCEPT_ARENA_SIZE * 4;
+        __libexcept_chunk* chunk = malloc(sizeof(__libexcept_chunk) + chunk_size);
+        if (chunk == NULL)
+        {
+            fprintf(stderr, "Could not allocate exception of type \"%s\"\n", id->name);
+            abort();
+        }
+
+        chunk->next = state->chunks;
+        state->chunks = chunk;
+        state->top = (char*)chunk->data;
+        state->end = (char*)chunk->data + chunk_size;
+    }
+
+    void* data = state->top;
+    state->top += size;
+    return data;
+}
+
+void* __libexcept_allocate_slow(const libexcept_type_t* id, size_t exception_size)
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+
+    if (state->top == NULL)
+    {
+        state->top = (char*)state->buffer;
+        state->end = (char*)state->buffer + sizeof(state->buffer);
+    }
+
+    char* top = state->top;
+    char* end = state->end;
+    __libexcept_record* record =
+        __libexcept_reserve(id, sizeof(__libexcept_record) + __LIBEXCEPT_ALIGN(exception_size));
+
+    record->type = id;
+    record->top = top;
+    record->end = end;
+    record->size = exception_size;
+    state->pending = record;
+    return record->payload;
+}
+
+#ifdef LIBEXCEPT_REGIONS
+/*
+  The first region chunk of a thread is kept for later regions once all of them are released. When
+  the thread exits it is freed along with whatever regions are left, which is the case if it exits
+  from within a try block.
+ */
+
+#define __LIBEXCEPT_REGION_CHUNK_SIZE 4096
+
+typedef struct __libexcept_promoted
+{
+    struct __libexcept_promoted* next;
+    max_align_t data[];
+} __libexcept_promoted;
+
+static void __libexcept_free_promoted(__libexcept_region* region)
+{
+    while (region->promoted != NULL)
+    {
+        __libexcept_promoted* next = region->promoted->next;
+        free(region->promoted);
+        region->promoted = next;
+    }
+}
+
+#if defined(LIBEXCEPT_THREAD_AWARE) || defined(LIBEXCEPT_FIBERS)
+static void __libexcept_free_regions(__libexcept_state* state)
+{
+    while (state->region != NULL)
+    {
+        __libexcept_region* region = state->region;
+        state->region = region->previous;
+        __libexcept_free_promoted(region);
+        if (region->allocated)
+        {
+            free(region);
+        }
+    }
+    while (state->region_chunks != NULL)
+    {
+        __libexcept_chunk* next = state->region_chunks->next;
+        free(state->region_chunks);
+        state->region_chunks = next;
+    }
+    state->region_top = NULL;
+    state->region_end = NULL;
+}
+#endif
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static tss_t __libexcept_region_key;
+static once_flag __libexcept_region_once = ONCE_FLAG_INIT;
+
+static void __libexcept_free_thread_regions(void* state)
+{
+    __libexcept_free_regions(state);
+}
+
+static void __libexcept_init_region_key()
+{
+    tss_create(&__libexcept_region_key, __libexcept_free_thread_regions);
+}
+#endif
+
+static int __libexcept_grow_region(__libexcept_state* state, size_t size)
+{
+    size_t chunk_size = size > __LIBEXCEPT_REGION_CHUNK_SIZE ? size : __LIBEXCEPT_REGION_CHUNK_SIZE;
+    __libexcept_chunk* chunk = malloc(sizeof(__libexcept_chunk) + chunk_size);
+    if (chunk == NULL)
+    {
+        return 0;
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    if (state->region_chunks == NULL && state == &__libexcept_thread)
+    {
+        call_once(&__libexcept_region_once, __libexcept_init_region_key);
+        tss_set(__libexcept_region_key, state);
+    }
+#endif
+
+    chunk->next = state->region_chunks;
+    state->region_chunks = chunk;
+    state->region_top = (char*)chunk->data;
+    state->region_end = (char*)chunk->data + chunk_size;
+    return 1;
+}
+
+static void* __libexcept_bump(__libexcept_state* state, size_t size)
+{
+    size = __LIBEXCEPT_ALIGN(size);
+
+    if ((size_t)(state->region_end - state->region_top) < size &&
+        !__libexcept_grow_region(state, size))
+    {
+        return NULL;
+    }
+
+    void* data = state->region_top;
+    state->region_top += size;
+    return data;
+}
+
+/*
+  Creates a region for the try block of owner on top of the others, starting at the current
+  position.
+ */
+static __libexcept_region* __libexcept_push_region(__libexcept_state* state,
+                                                   __LIBEXCEPT_JMP_BUF* owner)
+{
+    // A region always starts within a chunk, which is never freed along with it.
+    if (state->region_chunks == NULL && !__libexcept_grow_region(state, 0))
+    {
+        return NULL;
+    }
+
+    char* top = state->region_top;
+    char* end = state->region_end;
+    __libexcept_chunk* chunks = state->region_chunks;
+
+    __libexcept_region* region = __libexcept_bump(state, sizeof(__libexcept_region));
+    if (region == NULL)
+    {
+        return NULL;
+    }
+
+    region->previous = state->region;
+    region->owner = owner;
+    region->top = top;
+    region->end = end;
+    region->chunks = chunks;
+    region->promoted = NULL;
+    region->allocated = 0;
+    state->region = region;
+    return region;
+}
+
+void* libexcept_region_alloc(size_t size)
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+
+    if (state->context == NULL)
+    {
+        return NULL;
+    }
+
+    if ((state->region == NULL || state->region->owner != state->context) &&
+        __libexcept_push_region(state, state->context) == NULL)
+    {
+        return NULL;
+    }
+
+    return __libexcept_bump(state, size);
+}
+
+/*
+  Gets the region of the try block enclosing the innermost one, creating it if needed.
+ */
+static __libexcept_region* __libexcept_enclosing_region(__libexcept_state* state)
+{
+    if (state->context == NULL)
+    {
+        return NULL;
+    }
+
+    __LIBEXCEPT_JMP_BUF* parent = ((__libexcept_frame*)state->context)->previous;
+    if (parent == NULL)
+    {
+        return NULL;
+    }
+
+    // Only the innermost try block may have a region above that of its parent.
+    __libexcept_region* inner = state->region;
+    if (inner == NULL || inner->owner != state->context)
+    {
+        if (inner != NULL && inner->owner == parent)
+        {
+            return inner;
+        }
+        return __libexcept_push_region(state, parent);
+    }
+    if (inner->previous != NULL && inner->previous->owner == parent)
+    {
+        return inner->previous;
+    }
+
+    // Releasing the region of the innermost try block restores the position its own region has to
+    // start at, so this one is not given any memory from the chunks.
+    __libexcept_region* region = malloc(sizeof(__libexcept_region));
+    if (region == NULL)
+    {
+        return NULL;
+    }
+
+    *region = (__libexcept_region){
+        .previous = inner->previous,
+        .owner = parent,
+        .top = inner->top,
+        .end = inner->end,
+        .chunks = inner->chunks,
+        .allocated = 1,
+    };
+    inner->previous = region;
+    return region;
+}
+
+void* libexcept_region_promote(const void* pointer, size_t size)
+{
+    __libexcept_region* region = __libexcept_enclosing_region(&__LIBEXCEPT_TASK);
+    if (region == NULL)
+    {
+        return NULL;
+    }
+
+    __libexcept_promoted* promoted = malloc(sizeof(__libexcept_promoted) + size);
+    if (promoted == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(promoted->data, pointer, size);
+    promoted->next = region->promoted;
+    region->promoted = promoted;
+    return promoted->data;
+}
+
+void __libexcept_release_region()
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    __libexcept_region* region = state->region;
+
+    __libexcept_free_promoted(region);
+
+    state->region = region->previous;
+    state->region_top = region->top;
+    state->region_end = region->end;
+
+    while (state->region_chunks != region->chunks)
+    {
+        __libexcept_chunk* next = state->region_chunks->next;
+        free(state->region_chunks);
+        state->region_chunks = next;
+    }
+
+    if (region->allocated)
+    {
+        free(region);
+    }
+}
+#endif
+
+#ifdef LIBEXCEPT_BACKTRACE
+unsigned libexcept_backtrace_sampling = 1;
+
+/*
+  Decides whether to capture a backtrace for this throw of type.
+ */
+static int __libexcept_sample(const libexcept_type_t* type)
+{
+    if (libexcept_backtrace_sampling == 0)
+    {
+        return 0;
+    }
+
+    __libexcept_state* state = &__libexcept_thread;
+    unsigned* throws = &state->sampled_throws[__LIBEXCEPT_SAMPLED_TYPES];
+    size_t start = ((size_t)type / sizeof(libexcept_type_t)) % __LIBEXCEPT_SAMPLED_TYPES;
+
+    for (size_t i = 0; i < __LIBEXCEPT_SAMPLED_TYPES; i++)
+    {
+        size_t index = (start + i) % __LIBEXCEPT_SAMPLED_TYPES;
+        if (state->sampled_types[index] == type || state->sampled_types[index] == NULL)
+        {
+            state->sampled_types[index] = type;
+            throws = &state->sampled_throws[index];
+            break;
+        }
+    }
+
+    return (*throws)++ % libexcept_backtrace_sampling == 0;
+}
+
+/*
+  caller is the return address of the throw function, the frames before it are within libexcept.
+ */
+static void __libexcept_capture(__libexcept_record* record, void* caller)
+{
+    void* frames[LIBEXCEPT_BACKTRACE_DEPTH + 4];
+    int count = backtrace(frames, LIBEXCEPT_BACKTRACE_DEPTH + 4);
+    int first = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (frames[i] == caller)
+        {
+            first = i;
+            break;
+        }
+    }
+
+    count -= first;
+    if (count > LIBEXCEPT_BACKTRACE_DEPTH)
+    {
+        count = LIBEXCEPT_BACKTRACE_DEPTH;
+    }
+
+    if (count > 0)
+    {
+        record->frames = __libexcept_reserve(record->type, count * sizeof(void*));
+        record->frame_count = count;
+        memcpy(record->frames, frames + first, count * sizeof(void*));
+    }
+}
+
+/*
+  Resolved addresses are kept in a hash table which is never freed.
+ */
+
+#define __LIBEXCEPT_SYMBOL_BUCKETS 256
+
+typedef struct __libexcept_symbol
+{
+    void* address;
+    char** description;
+    struct __libexcept_symbol* next;
+} __libexcept_symbol;
+
+static __libexcept_symbol* __libexcept_symbols[__LIBEXCEPT_SYMBOL_BUCKETS];
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static mtx_t __libexcept_symbols_lock;
+static once_flag __libexcept_symbols_once = ONCE_FLAG_INIT;
+
+static void __libexcept_init_symbols()
+{
+    mtx_init(&__libexcept_symbols_lock, mtx_plain);
+}
+#endif
+
+const char* libexcept_symbolize(void* address)
+{
+    __libexcept_symbol** bucket =
+        &__libexcept_symbols[((size_t)address >> 4) % __LIBEXCEPT_SYMBOL_BUCKETS];
+    __libexcept_symbol* symbol;
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    call_once(&__libexcept_symbols_once, __libexcept_init_symbols);
+    mtx_lock(&__libexcept_symbols_lock);
+#endif
+
+    for (symbol = *bucket; symbol != NULL; symbol = symbol->next)
+    {
+        if (symbol->address == address)
+        {
+            break;
+        }
+    }
+
+    if (symbol == NULL && (symbol = malloc(sizeof(__libexcept_symbol))) != NULL)
+    {
+        symbol->address = address;
+        symbol->description = backtrace_symbols(&address, 1);
+        symbol->next = *bucket;
+        *bucket = symbol;
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    mtx_unlock(&__libexcept_symbols_lock);
+#endif
+
+    return symbol != NULL && symbol->description != NULL ? symbol->description[0] : NULL;
+}
+
+size_t libexcept_exception_backtrace(void* const** frames)
+{
+    __libexcept_record* record = __LIBEXCEPT_TASK.current;
+
+    if (record == NULL)
+    {
+        *frames = NULL;
+        return 0;
+    }
+
+    *frames = record->frames;
+    return record->frame_count;
+}
+
+static void __libexcept_print_backtrace()
+{
+    __libexcept_record* record = __LIBEXCEPT_TASK.current;
+
+    for (size_t i = 0; i < record->frame_count; i++)
+    {
+        const char* description = libexcept_symbolize(record->frames[i]);
+        if (description != NULL)
+        {
+            fprintf(stderr, "    at %s\n", description);
+        }
+        else
+        {
+            fprintf(stderr, "    at %p\n", record->frames[i]);
+        }
+    }
+}
+#endif
+
+static noreturn void __libexcept_raise();
+
+#ifdef LIBEXCEPT_RECORDER
+static _Atomic(libexcept_recorder_header_t*) __libexcept_recorder;
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static tss_t __libexcept_recorder_key;
+
+static void __libexcept_release_ring(void* ring)
+{
+    atomic_store_explicit(&((libexcept_recorder_ring_t*)ring)->owner, 0, memory_order_release);
+}
+#endif
+
+static uint64_t __libexcept_thread_id()
+{
+#if defined(__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#elif defined(LIBEXCEPT_THREAD_AWARE)
+    return (uint64_t)(uintptr_t)thrd_current();
+#else
+    return (uint64_t)getpid();
+#endif
+}
+
+/*
+  Set by the first call to libexcept_start_recorder, unless it fails. Threads only try to claim a
+  ring once, so the mapping can not be replaced.
+ */
+static atomic_int __libexcept_recorder_started;
+
+static int __libexcept_map_recorder(const char* path, int rings)
+{
+    size_t size = sizeof(libexcept_recorder_header_t) + rings * sizeof(libexcept_recorder_ring_t);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (ftruncate(fd, size) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    libexcept_recorder_header_t* header =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    // The file is all zeros, so only the header has to be filled.
+    memcpy(header->magic, LIBEXCEPT_RECORDER_MAGIC, sizeof(header->magic));
+    header->version = LIBEXCEPT_RECORDER_VERSION;
+    header->ring_count = rings;
+    header->entry_count = LIBEXCEPT_RECORDER_ENTRIES;
+    header->entry_size = sizeof(libexcept_recorder_entry_t);
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    tss_create(&__libexcept_recorder_key, __libexcept_release_ring);
+#endif
+    atomic_store_explicit(&__libexcept_recorder, header, memory_order_release);
+    return 0;
+}
+
+int libexcept_start_recorder(const char* path, int rings)
+{
+    if (rings <= 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (atomic_exchange(&__libexcept_recorder_started, 1))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (__libexcept_map_recorder(path, rings) == -1)
+    {
+        atomic_store(&__libexcept_recorder_started, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+  Claims a free ring for the current thread. This is only attempted once per thread.
+ */
+static libexcept_recorder_ring_t* __libexcept_claim_ring(libexcept_recorder_header_t* header)
+{
+    __libexcept_state* state = &__libexcept_thread;
+    uint64_t thread = __libexcept_thread_id();
+
+    state->recorder_claimed = 1;
+
+    for (uint32_t i = 0; i < header->ring_count; i++)
+    {
+        uint64_t free = 0;
+        if (atomic_compare_exchange_strong(&header->rings[i].owner, &free, thread))
+        {
+            state->recorder_ring = &header->rings[i];
+#ifdef LIBEXCEPT_THREAD_AWARE
+            tss_set(__libexcept_recorder_key, state->recorder_ring);
+#endif
+            return state->recorder_ring;
+        }
+    }
+
+    return NULL;
+}
+
+static void __libexcept_copy_text(char* destination, const char* source, size_t size)
+{
+    if (source != NULL)
+    {
+        strncpy(destination, source, size - 1);
+    }
+    destination[size - 1] = '\0';
+}
+
+/*
+  Appends the pending exception to the ring of the current thread.
+ */
+static void __libexcept_record_throw(__libexcept_record* record, const libexcept_site_t* site)
+{
+    __libexcept_state* state = &__libexcept_thread;
+    libexcept_recorder_ring_t* ring = state->recorder_ring;
+    libexcept_recorder_header_t* header =
+        atomic_load_explicit(&__libexcept_recorder, memory_order_acquire);
+
+    if (header == NULL)
+    {
+        return;
+    }
+
+    if (ring == NULL)
+    {
+        if (state->recorder_claimed || (ring = __libexcept_claim_ring(header)) == NULL)
+        {
+            atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    uint64_t sequence = ++ring->head;
+    libexcept_recorder_entry_t* entry =
+        &ring->entries[(sequence - 1) % LIBEXCEPT_RECORDER_ENTRIES];
+    atomic_store_explicit(&entry->sequence, 0, memory_order_relaxed);
+    atomic_signal_fence(memory_order_release);
+
+    // This reads the vDSO clock on Linux rather than making a system call.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    entry->timestamp = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+    entry->thread = atomic_load_explicit(&ring->owner, memory_order_relaxed);
+    entry->line = site != NULL ? site->line : 0;
+    entry->severity = site != NULL ? site->severity : LIBEXCEPT_SEVERITY_ERROR;
+    entry->payload_size = record->size;
+    __libexcept_copy_text(entry->type, record->type->name, sizeof(entry->type));
+    __libexcept_copy_text(entry->file, site != NULL ? site->file : NULL, sizeof(entry->file));
+    __libexcept_copy_text(entry->function, site != NULL ? site->function : NULL,
+                          sizeof(entry->function));
+    memcpy(entry->payload, record->payload,
+           record->size < sizeof(entry->payload) ? record->size : sizeof(entry->payload));
+
+    atomic_store_explicit(&entry->sequence, sequence, memory_order_release);
+}
+#endif
+
+#ifdef LIBEXCEPT_BACKTRACE
+#define __LIBEXCEPT_CALLER() __builtin_return_address(0)
+#else
+#define __LIBEXCEPT_CALLER() NULL
+#endif
+
+/*
+  Makes the pending exception current and throws it.
+ */
+static noreturn void __libexcept_commit(const libexcept_site_t* site,
+                                        const libexcept_message_t* message,
+                                        void* caller)
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+
+#ifdef LIBEXCEPT_RECORDER
+    __libexcept_record_throw(state->pending, site);
+#endif
+
+    state->pending->site = site;
+    state->pending->message = message;
+    state->pending->formatted = NULL;
+    state->pending->previous = state->current;
+    __libexcept_set_current(state->pending);
+    state->pending = NULL;
+
+    __LIBEXCEPT_COUNT(throws);
+    __LIBEXCEPT_COUNT_TYPE(state->current->type, throws);
+
+#ifdef LIBEXCEPT_BACKTRACE
+    state->current->frame_count = 0;
+    if (__libexcept_sample(state->current->type))
+    {
+        __libexcept_capture(state->current, caller);
+    }
+#else
+    (void)caller;
+#endif
+    __libexcept_raise();
+}
+
+void __libexcept_throw(const libexcept_site_t* site)
+{
+    __libexcept_commit(site, NULL, __LIBEXCEPT_CALLER());
+}
+
+fenv_t* __libexcept_check_fp(const fenv_t* environment, int excepts, const libexcept_site_t* site)
+{
+    int raised = fetestexcept(excepts);
+    fesetenv(environment);
+
+    if (raised == 0)
+    {
+        return NULL;
+    }
+
+    // Uses the messages of the signal handler, reporting the most severe exception raised.
+    arithmetic_error_t error = {
+        .message = "Floating point inexact result.",
+#ifdef __GNUC__
+        .pc = __builtin_return_address(0),
+#endif
+    };
+
+#ifdef FE_UNDERFLOW
+    if (raised & FE_UNDERFLOW)
+    {
+        error.message = "Floating point underflow.";
+    }
+#endif
+#ifdef FE_OVERFLOW
+    if (raised & FE_OVERFLOW)
+    {
+        error.message = "Floating point overflow.";
+    }
+#endif
+#ifdef FE_DIVBYZERO
+    if (raised & FE_DIVBYZERO)
+    {
+        error.message = "Floating point division by zero.";
+    }
+#endif
+#ifdef FE_INVALID
+    if (raised & FE_INVALID)
+    {
+        error.message = "Invalid floating point operation.";
+    }
+#endif
+
+    *(arithmetic_error_t*)__libexcept_allocate(LIBEXCEPT_TYPE(arithmetic_error_t),
+                                               sizeof(arithmetic_error_t)) = error;
+    __libexcept_commit(site, NULL, __LIBEXCEPT_CALLER());
+}
+
+/*
+  Messages are formatted one conversion at a time, by rewriting each conversion specification for
+  the type its argument is stored as.
+ */
+
+typedef enum
+{
+    __LIBEXCEPT_ARGUMENT_INVALID,
+    __LIBEXCEPT_ARGUMENT_SIGNED,
+    __LIBEXCEPT_ARGUMENT_UNSIGNED,
+    __LIBEXCEPT_ARGUMENT_CHAR,
+    __LIBEXCEPT_ARGUMENT_FLOAT,
+    __LIBEXCEPT_ARGUMENT_STRING,
+    __LIBEXCEPT_ARGUMENT_POINTER,
+    __LIBEXCEPT_ARGUMENT_IGNORED,
+} __libexcept_argument_kind;
+
+typedef struct
+{
+    const char* modifier;
+    size_t modifier_length;
+    int stars;
+    __libexcept_argument_kind kind;
+} __libexcept_conversion;
+
+/*
+  Parses the conversion specification following a '%' and returns its end.
+ */
+static const char* __libexcept_parse_conversion(const char* format,
+                                                __libexcept_conversion* conversion)
+{
+    conversion->stars = 0;
+
+    format += strspn(format, "-+ #0");
+    if (*format == '*')
+    {
+        conversion->stars++;
+        format++;
+    }
+    format += strspn(format, "0123456789");
+    if (*format == '.')
+    {
+        format++;
+        if (*format == '*')
+        {
+            conversion->stars++;
+            format++;
+        }
+        format += strspn(format, "0123456789");
+    }
+
+    conversion->modifier = format;
+    conversion->modifier_length = strspn(format, "hljztL");
+    format += conversion->modifier_length;
+
+    switch (*format)
+    {
+    case 'd':
+    case 'i':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_SIGNED;
+        break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_UNSIGNED;
+        break;
+    case 'c':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_CHAR;
+        break;
+    case 'a':
+    case 'A':
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_FLOAT;
+        break;
+    case 's':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_STRING;
+        break;
+    case 'p':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_POINTER;
+        break;
+    case 'n':
+        conversion->kind = __LIBEXCEPT_ARGUMENT_IGNORED;
+        break;
+    default:
+        conversion->kind = __LIBEXCEPT_ARGUMENT_INVALID;
+        return format;
+    }
+
+    return format + 1;
+}
+
+static int __libexcept_has_modifier(const __libexcept_conversion* conversion, const char* modifier)
+{
+    return conversion->modifier_length == strlen(modifier) &&
+           strncmp(conversion->modifier, modifier, conversion->modifier_length) == 0;
+}
+
+static intmax_t __libexcept_read_signed(const __libexcept_conversion* conversion,
+                                        va_list* arguments)
+{
+    if (__libexcept_has_modifier(conversion, "hh"))
+        return (signed char)va_arg(*arguments, int);
+    if (__libexcept_has_modifier(conversion, "h"))
+        return (short)va_arg(*arguments, int);
+    if (__libexcept_has_modifier(conversion, "l"))
+        return va_arg(*arguments, long);
+    if (__libexcept_has_modifier(conversion, "ll"))
+        return va_arg(*arguments, long long);
+    if (__libexcept_has_modifier(conversion, "j"))
+        return va_arg(*arguments, intmax_t);
+    if (__libexcept_has_modifier(conversion, "z"))
+        return (intmax_t)va_arg(*arguments, size_t);
+    if (__libexcept_has_modifier(conversion, "t"))
+        return va_arg(*arguments, ptrdiff_t);
+    return va_arg(*arguments, int);
+}
+
+static uintmax_t __libexcept_read_unsigned(const __libexcept_conversion* conversion,
+                                           va_list* arguments)
+{
+    if (__libexcept_has_modifier(conversion, "hh"))
+        return (unsigned char)va_arg(*arguments, unsigned);
+    if (__libexcept_has_modifier(conversion, "h"))
+        return (unsigned short)va_arg(*arguments, unsigned);
+    if (__libexcept_has_modifier(conversion, "l"))
+        return va_arg(*arguments, unsigned long);
+    if (__libexcept_has_modifier(conversion, "ll"))
+        return va_arg(*arguments, unsigned long long);
+    if (__libexcept_has_modifier(conversion, "j"))
+        return va_arg(*arguments, uintmax_t);
+    if (__libexcept_has_modifier(conversion, "z"))
+        return va_arg(*arguments, size_t);
+    if (__libexcept_has_modifier(conversion, "t"))
+        return (uintmax_t)va_arg(*arguments, ptrdiff_t);
+    return va_arg(*arguments, unsigned);
+}
+
+void __libexcept_throw_message(const libexcept_site_t* site,
+                               libexcept_message_t* message,
+                               const char* format,
+                               ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+
+    message->format = format;
+    message->count = 0;
+
+    while ((format = strchr(format, '%')) != NULL)
+    {
+        if (format[1] == '%')
+        {
+            format += 2;
+            continue;
+        }
+
+        __libexcept_conversion conversion;
+        format = __libexcept_parse_conversion(format + 1, &conversion);
+
+        if (conversion.kind == __LIBEXCEPT_ARGUMENT_INVALID)
+        {
+            continue;
+        }
+
+        if (message->count + conversion.stars + 1 > LIBEXCEPT_MESSAGE_ARGUMENTS)
+        {
+            break;
+        }
+
+        for (int i = 0; i < conversion.stars; i++)
+        {
+            message->arguments[message->count++].i = va_arg(arguments, int);
+        }
+
+        switch (conversion.kind)
+        {
+        case __LIBEXCEPT_ARGUMENT_SIGNED:
+            message->arguments[message->count].i = __libexcept_read_signed(&conversion, &arguments);
+            break;
+        case __LIBEXCEPT_ARGUMENT_UNSIGNED:
+            message->arguments[message->count].u =
+                __libexcept_read_unsigned(&conversion, &arguments);
+            break;
+        case __LIBEXCEPT_ARGUMENT_CHAR:
+            message->arguments[message->count].i = __libexcept_has_modifier(&conversion, "l")
+                                                       ? (intmax_t)va_arg(arguments, wint_t)
+                                                       : va_arg(arguments, int);
+            break;
+        case __LIBEXCEPT_ARGUMENT_FLOAT:
+            message->arguments[message->count].f = __libexcept_has_modifier(&conversion, "L")
+                                                       ? va_arg(arguments, long double)
+                                                       : va_arg(arguments, double);
+            break;
+        default:
+            message->arguments[message->count].p = va_arg(arguments, const void*);
+            break;
+        }
+
+        message->count++;
+    }
+
+    va_end(arguments);
+    __libexcept_commit(site, message, __LIBEXCEPT_CALLER());
+}
+
+/*
+  Appends text to buffer, keeping track of the length of the whole message like snprintf does.
+ */
+static void __libexcept_append(char* buffer, size_t size, size_t* length, const char* text,
+                               size_t text_length)
+{
+    if (*length < size)
+    {
+        size_t available = size - *length;
+        memcpy(buffer + *length, text, text_length < available ? text_length : available);
+    }
+    *length += text_length;
+}
+
+size_t libexcept_format_message(const libexcept_message_t* message, char* buffer, size_t size)
+{
+    const char* format = message->format;
+    size_t length = 0;
+    int index = 0;
+
+    while (*format != '\0')
+    {
+        if (*format != '%')
+        {
+            size_t literal = strcspn(format, "%");
+            __libexcept_append(buffer, size, &length, format, literal);
+            format += literal;
+            continue;
+        }
+
+        if (format[1] == '%')
+        {
+            __libexcept_append(buffer, size, &length, "%", 1);
+            format += 2;
+            continue;
+        }
+
+        const char* start = format;
+        __libexcept_conversion conversion;
+        format = __libexcept_parse_conversion(format + 1, &conversion);
+
+        if (conversion.kind == __LIBEXCEPT_ARGUMENT_INVALID)
+        {
+            __libexcept_append(buffer, size, &length, start, format - start);
+            continue;
+        }
+
+        // The rest of the message did not fit in the exception.
+        if (index + conversion.stars + 1 > message->count)
+        {
+            break;
+        }
+
+        // Flags are kept, while stored widths and precisions replace the stars.
+        char specification[64];
+        size_t used = 0;
+        for (const char* c = start; c < conversion.modifier && used < 40; c++)
+        {
+            if (*c == '.' && c[1] == '*' && message->arguments[index].i < 0)
+            {
+                // A negative precision is taken as if it was omitted.
+                index++;
+                c++;
+            }
+            else if (*c == '*')
+            {
+                used += sprintf(specification + used, "%d", (int)message->arguments[index++].i);
+            }
+            else
+            {
+                specification[used++] = *c;
+            }
+        }
+
+        int wide = __libexcept_has_modifier(&conversion, "l");
+        const char* modifier = "";
+        switch (conversion.kind)
+        {
+        case __LIBEXCEPT_ARGUMENT_SIGNED:
+        case __LIBEXCEPT_ARGUMENT_UNSIGNED:
+            modifier = "j";
+            break;
+        case __LIBEXCEPT_ARGUMENT_FLOAT:
+            modifier = "L";
+            break;
+        case __LIBEXCEPT_ARGUMENT_CHAR:
+        case __LIBEXCEPT_ARGUMENT_STRING:
+            modifier = wide ? "l" : "";
+            break;
+        default:
+            break;
+        }
+        sprintf(specification + used, "%s%c", modifier, format[-1]);
+
+        char* output = length < size ? buffer + length : NULL;
+        size_t available = length < size ? size - length : 0;
+        int written = 0;
+
+        switch (conversion.kind)
+        {
+        case __LIBEXCEPT_ARGUMENT_SIGNED:
+            written = snprintf(output, available, specification, message->arguments[index].i);
+            break;
+        case __LIBEXCEPT_ARGUMENT_UNSIGNED:
+            written = snprintf(output, available, specification, message->arguments[index].u);
+            break;
+        case __LIBEXCEPT_ARGUMENT_CHAR:
+            written = wide ? snprintf(output, available, specification,
+                                      (wint_t)message->arguments[index].i)
+                           : snprintf(output, available, specification,
+                                      (int)message->arguments[index].i);
+            break;
+        case __LIBEXCEPT_ARGUMENT_FLOAT:
+            written = snprintf(output, available, specification, message->arguments[index].f);
+            break;
+        case __LIBEXCEPT_ARGUMENT_STRING:
+            written = wide ? snprintf(output, available, specification,
+                                      (const wchar_t*)message->arguments[index].p)
+                           : snprintf(output, available, specification,
+                                      (const char*)message->arguments[index].p);
+            break;
+        case __LIBEXCEPT_ARGUMENT_POINTER:
+            written = snprintf(output, available, specification, message->arguments[index].p);
+            break;
+        default:
+            break;
+        }
+
+        index++;
+        if (written > 0)
+        {
+            length += written;
+        }
+    }
+
+    if (size > 0)
+    {
+        buffer[length < size ? length : size - 1] = '\0';
+    }
+    return length;
+}
+
+/*
+  Captured exceptions small enough for a pooled block are recycled through a free list, since they
+  are usually created and released at the rate tasks fail.
+ */
+
+#define __LIBEXCEPT_POOLED_SIZE  128
+#define __LIBEXCEPT_POOL_MAXIMUM 64
+
+struct libexcept_captured
+{
+    _Atomic size_t references;
+    const libexcept_type_t* type;
+    const libexcept_site_t* site;
+    const libexcept_message_t* message;
+    size_t size;
+    struct libexcept_captured* next;
+    max_align_t payload[];
+};
+
+static libexcept_captured_t* __libexcept_pool;
+static size_t __libexcept_pool_size;
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static mtx_t __libexcept_pool_lock;
+static once_flag __libexcept_pool_once = ONCE_FLAG_INIT;
+
+static void __libexcept_init_pool()
+{
+    mtx_init(&__libexcept_pool_lock, mtx_plain);
+}
+#endif
+
+static libexcept_captured_t* __libexcept_new_captured(size_t size)
+{
+    libexcept_captured_t* captured = NULL;
+
+    if (size > __LIBEXCEPT_POOLED_SIZE)
+    {
+        return malloc(sizeof(libexcept_captured_t) + size);
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    call_once(&__libexcept_pool_once, __libexcept_init_pool);
+    mtx_lock(&__libexcept_pool_lock);
+#endif
+    if (__libexcept_pool != NULL)
+    {
+        captured = __libexcept_pool;
+        __libexcept_pool = captured->next;
+        __libexcept_pool_size--;
+    }
+#ifdef LIBEXCEPT_THREAD_AWARE
+    mtx_unlock(&__libexcept_pool_lock);
+#endif
+
+    if (captured == NULL)
+    {
+        captured = malloc(sizeof(libexcept_captured_t) + __LIBEXCEPT_POOLED_SIZE);
+    }
+    return captured;
+}
+
+static void __libexcept_delete_captured(libexcept_captured_t* captured)
+{
+    if (captured->size <= __LIBEXCEPT_POOLED_SIZE)
+    {
+#ifdef LIBEXCEPT_THREAD_AWARE
+        call_once(&__libexcept_pool_once, __libexcept_init_pool);
+        mtx_lock(&__libexcept_pool_lock);
+#endif
+        int pooled = __libexcept_pool_size < __LIBEXCEPT_POOL_MAXIMUM;
+        if (pooled)
+        {
+            captured->next = __libexcept_pool;
+            __libexcept_pool = captured;
+            __libexcept_pool_size++;
+        }
+#ifdef LIBEXCEPT_THREAD_AWARE
+        mtx_unlock(&__libexcept_pool_lock);
+#endif
+        if (pooled)
+        {
+            return;
+        }
+    }
+    free(captured);
+}
+
+// Moves a message pointing into one copy of an exception to the same place in another.
+static const libexcept_message_t* __libexcept_rebase_message(const libexcept_message_t* message,
+                                                             const void* from, size_t size,
+                                                             void* to)
+{
+    uintptr_t offset = (uintptr_t)message - (uintptr_t)from;
+    return offset < size ? (const libexcept_message_t*)((char*)to + offset) : message;
+}
+
+libexcept_captured_t* libexcept_capture()
+{
+    __libexcept_record* record = __LIBEXCEPT_TASK.current;
+    if (record == NULL)
+    {
+        return NULL;
+    }
+
+    libexcept_captured_t* captured = __libexcept_new_captured(record->size);
+    if (captured == NULL)
+    {
+        return NULL;
+    }
+
+    atomic_init(&captured->references, 1);
+    captured->type = record->type;
+    captured->site = record->site;
+    captured->size = record->size;
+    memcpy(captured->payload, record->payload, record->size);
+    captured->message =
+        __libexcept_rebase_message(record->message, record->payload, record->size,
+                                   captured->payload);
+    return captured;
+}
+
+libexcept_captured_t* libexcept_retain(libexcept_captured_t* captured)
+{
+    atomic_fetch_add_explicit(&captured->references, 1, memory_order_relaxed);
+    return captured;
+}
+
+void libexcept_release(libexcept_captured_t* captured)
+{
+    if (captured != NULL && atomic_fetch_sub_explicit(&captured->references, 1,
+                                                      memory_order_acq_rel) == 1)
+    {
+        __libexcept_delete_captured(captured);
+    }
+}
+
+void libexcept_rethrow_captured(libexcept_captured_t* captured)
+{
+    void* payload = __libexcept_allocate(captured->type, captured->size);
+    memcpy(payload, captured->payload, captured->size);
+
+    const libexcept_site_t* site = captured->site;
+    const libexcept_message_t* message =
+        __libexcept_rebase_message(captured->message, captured->payload, captured->size, payload);
+
+    libexcept_release(captured);
+    __libexcept_commit(site, message, __LIBEXCEPT_CALLER());
+}
+
+const libexcept_type_t* libexcept_captured_type(const libexcept_captured_t* captured)
+{
+    return captured->type;
+}
+
+const void* libexcept_captured_value(const libexcept_captured_t* captured)
+{
+    return captured->payload;
+}
+
+#ifdef LIBEXCEPT_THROW_IN
+/*
+  Threads are added to the list when they first poll and removed when they exit. Throwing into a
+  thread happens with the list locked, so that its state can not go away meanwhile.
+ */
+
+static __libexcept_state* __libexcept_reachable;
+static tss_t __libexcept_reachable_key;
+static mtx_t __libexcept_reachable_lock;
+static once_flag __libexcept_reachable_once = ONCE_FLAG_INIT;
+
+static void __libexcept_unreachable(void* data)
+{
+    __libexcept_state* state = data;
+
+    mtx_lock(&__libexcept_reachable_lock);
+    __libexcept_state** link = &__libexcept_reachable;
+    while (*link != state)
+    {
+        link = &(*link)->injection_next;
+    }
+    *link = state->injection_next;
+    mtx_unlock(&__libexcept_reachable_lock);
+
+    libexcept_release(atomic_exchange(&state->injected, NULL));
+}
+
+static void __libexcept_init_reachable()
+{
+    mtx_init(&__libexcept_reachable_lock, mtx_plain);
+    tss_create(&__libexcept_reachable_key, __libexcept_unreachable);
+}
+
+int __libexcept_throw_in(thrd_t thread,
+                         const libexcept_type_t* type,
+                         size_t size,
+                         const void* value,
+                         const libexcept_site_t* site)
+{
+    libexcept_captured_t* captured = __libexcept_new_captured(size);
+    if (captured == NULL)
+    {
+        return 0;
+    }
+
+    atomic_init(&captured->references, 1);
+    captured->type = type;
+    captured->site = site;
+    captured->message = NULL;
+    captured->size = size;
+    memcpy(captured->payload, value, size);
+
+    call_once(&__libexcept_reachable_once, __libexcept_init_reachable);
+    mtx_lock(&__libexcept_reachable_lock);
+
+    int delivered = 0;
+    for (__libexcept_state* state = __libexcept_reachable; state != NULL;
+         state = state->injection_next)
+    {
+        libexcept_captured_t* none = NULL;
+        if (thrd_equal(state->injection_thread, thread))
+        {
+            delivered = atomic_compare_exchange_strong(&state->injected, &none, captured);
+            if (delivered)
+            {
+                atomic_store_explicit(&state->injection, __LIBEXCEPT_INJECTION_PENDING,
+                                      memory_order_relaxed);
+            }
+            break;
+        }
+    }
+
+    mtx_unlock(&__libexcept_reachable_lock);
+
+    if (!delivered)
+    {
+        libexcept_release(captured);
+    }
+    return delivered;
+}
+
+void __libexcept_receive()
+{
+    __libexcept_state* state = &__libexcept_thread;
+
+    if (state->injection == __LIBEXCEPT_INJECTION_UNREACHABLE)
+    {
+        call_once(&__libexcept_reachable_once, __libexcept_init_reachable);
+        state->injection_thread = thrd_current();
+        tss_set(__libexcept_reachable_key, state);
+
+        mtx_lock(&__libexcept_reachable_lock);
+        state->injection_next = __libexcept_reachable;
+        __libexcept_reachable = state;
+        atomic_store_explicit(&state->injection, __LIBEXCEPT_INJECTION_IDLE, memory_order_relaxed);
+        mtx_unlock(&__libexcept_reachable_lock);
+        return;
+    }
+
+    // Reset first, so that an exception thrown in after this one is received at the next poll.
+    atomic_store_explicit(&state->injection, __LIBEXCEPT_INJECTION_IDLE, memory_order_relaxed);
+    libexcept_captured_t* captured = atomic_exchange(&state->injected, NULL);
+    if (captured != NULL)
+    {
+        libexcept_rethrow_captured(captured);
+    }
+}
+#endif
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+/*
+  Tasks are queued on a pool of detached worker threads. A single lock protects the queue, the
+  counts of the pool and the number of pending tasks of every group.
+ */
+
+struct libexcept_task_group
+{
+    _Atomic int cancelled;
+    struct libexcept_task_group* parent;
+    libexcept_failure_t failure;
+    size_t pending;
+    cnd_t done;
+    mtx_t lock;
+    aggregate_error_t errors;
+};
+
+typedef struct __libexcept_job
+{
+    struct __libexcept_job* next;
+    libexcept_task_group_t* group;
+    libexcept_task_t task;
+    size_t index;
+    void* argument;
+} __libexcept_job;
+
+static struct
+{
+    mtx_t lock;
+    cnd_t wake;
+    __libexcept_job* head;
+    __libexcept_job** tail;
+    size_t queued;
+    unsigned threads;
+    unsigned idle;
+    unsigned limit;
+} __libexcept_workers;
+
+static once_flag __libexcept_workers_once = ONCE_FLAG_INIT;
+
+static __LIBEXCEPT_THREAD_LOCAL libexcept_task_group_t* __libexcept_current_group;
+
+static int __libexcept_group_cancelled(const libexcept_task_group_t* group)
+{
+    for (; group != NULL; group = group->parent)
+    {
+        if (atomic_load_explicit(&group->cancelled, memory_order_relaxed))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int libexcept_cancelled()
+{
+    return __libexcept_group_cancelled(__libexcept_current_group);
+}
+
+static void __libexcept_fail(libexcept_task_group_t* group)
+{
+    atomic_store(&group->cancelled, 1);
+
+    libexcept_captured_t* captured = libexcept_capture();
+
+    mtx_lock(&group->lock);
+    size_t count = group->errors.count++;
+    if (count < LIBEXCEPT_AGGREGATE_ERRORS)
+    {
+        group->errors.errors[count] = captured;
+        captured = NULL;
+    }
+    mtx_unlock(&group->lock);
+
+    libexcept_release(captured);
+}
+
+static void __libexcept_run_task(libexcept_task_group_t* group, libexcept_task_t task, size_t index,
+                                 void* argument)
+{
+    libexcept_task_group_t* previous = __libexcept_current_group;
+    __libexcept_current_group = group;
+
+    if (!__libexcept_group_cancelled(group))
+    {
+        __LIBEXCEPT_TRY
+        {
+            task(index, argument);
+        }
+        __LIBEXCEPT_CATCH_ANY
+        {
+            __libexcept_fail(group);
+        }
+    }
+
+    __libexcept_current_group = previous;
+}
+
+static unsigned __libexcept_processor_count()
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (unsigned)count : 1;
+#else
+    return 1;
+#endif
+}
+
+static void __libexcept_init_workers()
+{
+    mtx_init(&__libexcept_workers.lock, mtx_plain);
+    cnd_init(&__libexcept_workers.wake);
+    __libexcept_workers.tail = &__libexcept_workers.head;
+    __libexcept_workers.limit = __libexcept_processor_count() - 1;
+}
+
+// Called with the lock of the pool held, which is released while the job runs.
+static void __libexcept_run_job(__libexcept_job* job)
+{
+    libexcept_task_group_t* group = job->group;
+
+    mtx_unlock(&__libexcept_workers.lock);
+    __libexcept_run_task(group, job->task, job->index, job->argument);
+    free(job);
+    mtx_lock(&__libexcept_workers.lock);
+
+    if (--group->pending == 0)
+    {
+        cnd_broadcast(&group->done);
+    }
+}
+
+static __libexcept_job* __libexcept_pop_job(libexcept_task_group_t* group)
+{
+    __libexcept_job** link = &__libexcept_workers.head;
+    while (*link != NULL && group != NULL && (*link)->group != group)
+    {
+        link = &(*link)->next;
+    }
+
+    __libexcept_job* job = *link;
+    if (job != NULL)
+    {
+        *link = job->next;
+        if (job->next == NULL)
+        {
+            __libexcept_workers.tail = link;
+        }
+        __libexcept_workers.queued--;
+    }
+    return job;
+}
+
+static int __libexcept_run_worker(void* argument)
+{
+    (void)argument;
+
+    mtx_lock(&__libexcept_workers.lock);
+    for (;;)
+    {
+        __libexcept_job* job = __libexcept_pop_job(NULL);
+        if (job != NULL)
+        {
+            __libexcept_run_job(job);
+        }
+        else
+        {
+            __libexcept_workers.idle++;
+            cnd_wait(&__libexcept_workers.wake, &__libexcept_workers.lock);
+            __libexcept_workers.idle--;
+        }
+    }
+
+    return 0;
+}
+
+/*
+  Starts a worker unless one is idle for a job about to be queued. Called with the lock of the pool
+  held. Returns thrd_success or the error of thrd_create.
+ */
+static int __libexcept_add_worker()
+{
+    if (__libexcept_workers.idle > __libexcept_workers.queued ||
+        __libexcept_workers.threads >= __libexcept_workers.limit)
+    {
+        return thrd_success;
+    }
+
+    thrd_t thread;
+    int result = thrd_create(&thread, __libexcept_run_worker, NULL);
+    if (result == thrd_success)
+    {
+        thrd_detach(thread);
+        __libexcept_workers.threads++;
+    }
+    return result;
+}
+
+static void __libexcept_init_group(libexcept_task_group_t* group, libexcept_failure_t failure)
+{
+    atomic_init(&group->cancelled, 0);
+    group->parent = __libexcept_current_group;
+    group->failure = failure;
+    group->pending = 0;
+    cnd_init(&group->done);
+    mtx_init(&group->lock, mtx_plain);
+    group->errors.count = 0;
+}
+
+libexcept_task_group_t* libexcept_create_task_group(libexcept_failure_t failure)
+{
+    libexcept_task_group_t* group = malloc(sizeof(libexcept_task_group_t));
+    if (group != NULL)
+    {
+        __libexcept_init_group(group, failure);
+    }
+    return group;
+}
+
+void libexcept_spawn(libexcept_task_group_t* group, libexcept_task_t task, size_t index,
+                     void* argument)
+{
+    __libexcept_job* job = malloc(sizeof(__libexcept_job));
+    if (job == NULL)
+    {
+        __libexcept_run_task(group, task, index, argument);
+        return;
+    }
+
+    *job = (__libexcept_job){
+        .group = group,
+        .task = task,
+        .index = index,
+        .argument = argument,
+    };
+
+    call_once(&__libexcept_workers_once, __libexcept_init_workers);
+
+    mtx_lock(&__libexcept_workers.lock);
+    group->pending++;
+    int started = __libexcept_add_worker();
+    if (started == thrd_success)
+    {
+        *__libexcept_workers.tail = job;
+        __libexcept_workers.tail = &job->next;
+        __libexcept_workers.queued++;
+        cnd_signal(&__libexcept_workers.wake);
+    }
+    else
+    {
+        group->pending--;
+    }
+    mtx_unlock(&__libexcept_workers.lock);
+
+    if (started != thrd_success)
+    {
+        free(job);
+
+        // Reported like a task that failed, so that the group is cancelled.
+        __LIBEXCEPT_TRY
+        {
+            __LIBEXCEPT_THROW(int, started == thrd_nomem ? ENOMEM : EAGAIN);
+        }
+        __LIBEXCEPT_CATCH_ANY
+        {
+            __libexcept_fail(group);
+        }
+    }
+}
+
+// Rethrows the errors of a group in the way it was created with, if any task failed.
+static void __libexcept_throw_errors(const aggregate_error_t* errors, libexcept_failure_t failure)
+{
+    if (errors->count == 0)
+    {
+        return;
+    }
+
+    // An exception that could not be captured is lost, so at least report the failure.
+    if (failure == LIBEXCEPT_FAIL_FIRST && errors->errors[0] != NULL)
+    {
+        for (size_t i = 1; i < errors->count && i < LIBEXCEPT_AGGREGATE_ERRORS; i++)
+        {
+            libexcept_release(errors->errors[i]);
+        }
+        libexcept_rethrow_captured(errors->errors[0]);
+    }
+
+    __LIBEXCEPT_THROW(aggregate_error_t, *errors);
+}
+
+static void __libexcept_wait_group(libexcept_task_group_t* group)
+{
+    call_once(&__libexcept_workers_once, __libexcept_init_workers);
+
+    mtx_lock(&__libexcept_workers.lock);
+    while (group->pending != 0)
+    {
+        __libexcept_job* job = __libexcept_pop_job(group);
+        if (job != NULL)
+        {
+            __libexcept_run_job(job);
+        }
+        else
+        {
+            cnd_wait(&group->done, &__libexcept_workers.lock);
+        }
+    }
+    mtx_unlock(&__libexcept_workers.lock);
+}
+
+static void __libexcept_destroy_group(libexcept_task_group_t* group)
+{
+    cnd_destroy(&group->done);
+    mtx_destroy(&group->lock);
+}
+
+void libexcept_wait_task_group(libexcept_task_group_t* group)
+{
+    __libexcept_wait_group(group);
+
+    aggregate_error_t errors = group->errors;
+    libexcept_failure_t failure = group->failure;
+    __libexcept_destroy_group(group);
+    free(group);
+
+    __libexcept_throw_errors(&errors, failure);
+}
+
+/*
+  Each thread running a parallel loop owns a contiguous share of the indices. Indices are claimed by
+  incrementing the next index of a share, which idle threads also do to the shares of others.
+ */
+
+typedef struct
+{
+    _Alignas(64) _Atomic size_t next;
+    size_t end;
+} __libexcept_share;
+
+typedef struct
+{
+    libexcept_task_group_t group;
+    libexcept_task_t task;
+    void* argument;
+    unsigned share_count;
+    __libexcept_share* shares;
+} __libexcept_loop;
+
+static int __libexcept_claim(__libexcept_loop* loop, size_t own, size_t* index)
+{
+    for (unsigned i = 0; i < loop->share_count; i++)
+    {
+        __libexcept_share* victim = &loop->shares[(own + i) % loop->share_count];
+        if (atomic_load_explicit(&victim->next, memory_order_relaxed) < victim->end)
+        {
+            *index = atomic_fetch_add_explicit(&victim->next, 1, memory_order_relaxed);
+            if (*index < victim->end)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The task of the group of a parallel loop, run once for every share.
+static void __libexcept_run_share(size_t share, void* argument)
+{
+    __libexcept_loop* loop = argument;
+    size_t index;
+
+    while (!__libexcept_group_cancelled(&loop->group) && __libexcept_claim(loop, share, &index))
+    {
+        __libexcept_run_task(&loop->group, loop->task, index, loop->argument);
+    }
+}
+
+void libexcept_parallel_for(size_t count, libexcept_task_t task, void* argument, unsigned threads,
+                            libexcept_failure_t failure)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (threads == 0)
+    {
+        threads = __libexcept_processor_count();
+    }
+    if (threads > count)
+    {
+        threads = (unsigned)count;
+    }
+
+    __libexcept_loop loop = {
+        .task = task,
+        .argument = argument,
+        .share_count = threads,
+        .shares = aligned_alloc(_Alignof(__libexcept_share), threads * sizeof(__libexcept_share)),
+    };
+    __libexcept_init_group(&loop.group, failure);
+
+    // Without memory for the shares the whole range is run by the calling thread.
+    __libexcept_share single;
+    if (loop.shares == NULL)
+    {
+        loop.share_count = 1;
+        loop.shares = &single;
+    }
+
+    for (unsigned i = 0; i < loop.share_count; i++)
+    {
+        atomic_init(&loop.shares[i].next, count * i / loop.share_count);
+        loop.shares[i].end = count * (i + 1) / loop.share_count;
+    }
+
+    if (loop.share_count > 1)
+    {
+        call_once(&__libexcept_workers_once, __libexcept_init_workers);
+        mtx_lock(&__libexcept_workers.lock);
+        if (__libexcept_workers.limit < loop.share_count - 1)
+        {
+            __libexcept_workers.limit = loop.share_count - 1;
+        }
+        mtx_unlock(&__libexcept_workers.lock);
+    }
+
+    for (unsigned i = 1; i < loop.share_count; i++)
+    {
+        libexcept_spawn(&loop.group, __libexcept_run_share, i, &loop);
+    }
+
+    __libexcept_run_task(&loop.group, __libexcept_run_share, 0, &loop);
+    __libexcept_wait_group(&loop.group);
+
+    __libexcept_destroy_group(&loop.group);
+    if (loop.shares != &single)
+    {
+        free(loop.shares);
+    }
+
+    __libexcept_throw_errors(&loop.group.errors, failure);
+}
+
+void libexcept_release_aggregate(const aggregate_error_t* error)
+{
+    for (size_t i = 0; i < error->count && i < LIBEXCEPT_AGGREGATE_ERRORS; i++)
+    {
+        libexcept_release(error->errors[i]);
+    }
+}
+#endif
+
+/*
+  Subscribers are kept in an immutable array per event, which writers replace under a lock. Readers
+  only write to their own state, storing the global epoch in reader_epoch while they dispatch and 0
+  once they are done, so that dispatching from many threads does not contend on a shared cache line.
+  Threads are added to the list of readers when they first dispatch and removed when they exit.
+  After publishing a new array, a writer advances the epoch and waits for every reader that entered
+  before that, and so could have loaded the old array, to leave before freeing it.
+ */
+
+struct libexcept_subscription
+{
+    libexcept_event_t event;
+    libexcept_hook_t hook;
+    void* context;
+};
+
+typedef struct
+{
+    size_t count;
+    _Atomic(libexcept_subscription_t*) subscriptions[];
+} __libexcept_subscribers;
+
+static _Atomic(__libexcept_subscribers*) __libexcept_subscribers_of[LIBEXCEPT_EVENT_COUNT];
 
 #ifdef LIBEXCEPT_THREAD_AWARE
-#include <threads.h>
-static thread_local char current_exception[LIBEXCEPT_MAX_THROWABLE_SIZE];
-static thread_local const char* current_id;
+static _Atomic unsigned long long __libexcept_epoch = 1;
+static __libexcept_state* __libexcept_readers;
+static tss_t __libexcept_readers_key;
+static mtx_t __libexcept_subscribers_lock;
+static once_flag __libexcept_subscribers_once = ONCE_FLAG_INIT;
+
+static void __libexcept_remove_reader(void* data)
+{
+    __libexcept_state* state = data;
+
+    mtx_lock(&__libexcept_subscribers_lock);
+    __libexcept_state** link = &__libexcept_readers;
+    while (*link != state)
+    {
+        link = &(*link)->reader_next;
+    }
+    *link = state->reader_next;
+    state->reader_registered = 0;
+    mtx_unlock(&__libexcept_subscribers_lock);
+}
+
+static void __libexcept_init_subscribers()
+{
+    mtx_init(&__libexcept_subscribers_lock, mtx_plain);
+    tss_create(&__libexcept_readers_key, __libexcept_remove_reader);
+}
+
+static void __libexcept_add_reader(__libexcept_state* state)
+{
+    call_once(&__libexcept_subscribers_once, __libexcept_init_subscribers);
+    tss_set(__libexcept_readers_key, state);
+
+    mtx_lock(&__libexcept_subscribers_lock);
+    state->reader_next = __libexcept_readers;
+    __libexcept_readers = state;
+    state->reader_registered = 1;
+    mtx_unlock(&__libexcept_subscribers_lock);
+}
+#endif
+
+// Announces the calling thread as a reader of the subscribers, returning the epoch it was already
+// reading in, if any, which is restored by __libexcept_leave_reader.
+static inline unsigned long long __libexcept_enter_reader()
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    __libexcept_state* state = &__libexcept_thread;
+    if (!state->reader_registered)
+    {
+        __libexcept_add_reader(state);
+    }
+
+    unsigned long long outer = atomic_load_explicit(&state->reader_epoch, memory_order_relaxed);
+    if (outer == 0)
+    {
+        // Sequentially consistent, so that either the subscribers loaded after it are the ones a
+        // writer published, or the writer sees this store and waits.
+        atomic_store(&state->reader_epoch, atomic_load(&__libexcept_epoch));
+    }
+    return outer;
 #else
-static char current_exception[LIBEXCEPT_MAX_THROWABLE_SIZE];
-static const char* current_id;
+    return 0;
 #endif
+}
 
-#ifdef LIBEXCEPT_SIGNAL_AWARE
-#include <signal.h>
+static inline void __libexcept_leave_reader(unsigned long long outer)
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    atomic_store_explicit(&__libexcept_thread.reader_epoch, outer, memory_order_release);
+#else
+    (void)outer;
+#endif
+}
 
-static void __libexcept_handle_signal(int signal, siginfo_t* info, void* context)
+static void __libexcept_lock_subscribers()
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    call_once(&__libexcept_subscribers_once, __libexcept_init_subscribers);
+    mtx_lock(&__libexcept_subscribers_lock);
+#endif
+}
+
+static void __libexcept_unlock_subscribers()
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    mtx_unlock(&__libexcept_subscribers_lock);
+#endif
+}
+
+// Waits until every reader that could have seen the previously published subscribers is gone.
+// Called with the lock held.
+static void __libexcept_synchronize()
+{
+#ifdef LIBEXCEPT_THREAD_AWARE
+    unsigned long long epoch = atomic_fetch_add(&__libexcept_epoch, 1) + 1;
+    for (__libexcept_state* state = __libexcept_readers; state != NULL; state = state->reader_next)
+    {
+        unsigned long long entered = atomic_load(&state->reader_epoch);
+        while (entered != 0 && entered < epoch)
+        {
+            thrd_yield();
+            entered = atomic_load(&state->reader_epoch);
+        }
+    }
+#endif
+}
+
+// Publishes the subscribers of an event and frees the previous array once no reader can use it.
+// Called with the lock held.
+static void __libexcept_publish(libexcept_event_t event, __libexcept_subscribers* subscribers)
 {
+    __libexcept_subscribers* previous =
+        atomic_exchange(&__libexcept_subscribers_of[event], subscribers);
+    __libexcept_synchronize();
+    free(previous);
+}
+
+static void __libexcept_ignore(libexcept_event_t event, void* exception, void* context)
+{
+    (void)event;
+    (void)exception;
     (void)context;
+}
 
-    switch (signal)
+// Takes the place of a subscription that could not be removed from its array.
+static libexcept_subscription_t __libexcept_removed = {.hook = __libexcept_ignore};
+
+libexcept_subscription_t* libexcept_subscribe(libexcept_event_t event, libexcept_hook_t hook,
+                                              void* context)
+{
+    libexcept_subscription_t* subscription = malloc(sizeof(libexcept_subscription_t));
+    if (subscription == NULL)
     {
-    case SIGFPE: {
-        arithmetic_error_t error = {
-            .pc = info->si_addr,
-        };
+        return NULL;
+    }
+    subscription->event = event;
+    subscription->hook = hook;
+    subscription->context = context;
 
-        switch (info->si_code)
+    __libexcept_lock_subscribers();
+
+    __libexcept_subscribers* current = atomic_load(&__libexcept_subscribers_of[event]);
+    size_t count = current != NULL ? current->count : 0;
+    __libexcept_subscribers* subscribers = malloc(
+        sizeof(__libexcept_subscribers) + (count + 1) * sizeof(libexcept_subscription_t*));
+
+    if (subscribers == NULL)
+    {
+        __libexcept_unlock_subscribers();
+        free(subscription);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        subscribers->subscriptions[i] = current->subscriptions[i];
+    }
+    subscribers->subscriptions[count] = subscription;
+    subscribers->count = count + 1;
+    __libexcept_publish(event, subscribers);
+
+    __libexcept_unlock_subscribers();
+    return subscription;
+}
+
+void libexcept_unsubscribe(libexcept_subscription_t* subscription)
+{
+    libexcept_event_t event = subscription->event;
+
+    __libexcept_lock_subscribers();
+
+    __libexcept_subscribers* current = atomic_load(&__libexcept_subscribers_of[event]);
+    __libexcept_subscribers* subscribers = NULL;
+
+    if (current->count > 1)
+    {
+        subscribers = malloc(sizeof(__libexcept_subscribers) +
+                             (current->count - 1) * sizeof(libexcept_subscription_t*));
+    }
+
+    if (current->count > 1 && subscribers == NULL)
+    {
+        // Nothing may fail here, so the subscription is replaced in place instead.
+        for (size_t i = 0; i < current->count; i++)
         {
-        case FPE_INTDIV:
-            error.message = "Integer division by zero.";
-            break;
-        case FPE_INTOVF:
-            error.message = "Integer overflow.";
-            break;
-        case FPE_FLTDIV:
-            error.message = "Floating point division by zero.";
-            break;
-        case FPE_FLTOVF:
-            error.message = "Floating point overflow.";
-            break;
-        case FPE_FLTUND:
-            error.message = "Floating point underflow.";
-            break;
-        case FPE_FLTRES:
-            error.message = "Floating point inexact result.";
-            break;
-        case FPE_FLTINV:
-            error.message = "Invalid floating point operation.";
-            break;
-        case FPE_FLTSUB:
-            error.message = "Subscript out of range.";
-            break;
-        default:
-            error.message = "Unknown arithmetic exception.";
-            break;
+            if (current->subscriptions[i] == subscription)
+            {
+                atomic_store(&current->subscriptions[i], &__libexcept_removed);
+            }
         }
-        throw(arithmetic_error_t, error);
+        __libexcept_synchronize();
     }
-    case SIGBUS:
-        if (info->si_code == BUS_ADRALN)
+    else
+    {
+        if (subscribers != NULL)
         {
-            misaligned_access_error_t error = {
-                .message = "Invalid address alignment.",
-                .address = info->si_addr,
-            };
-            throw(misaligned_access_error_t, error);
+            subscribers->count = 0;
+            for (size_t i = 0; i < current->count; i++)
+            {
+                if (current->subscriptions[i] != subscription)
+                {
+                    subscribers->subscriptions[subscribers->count++] = current->subscriptions[i];
+                }
+            }
         }
-    case SIGSEGV: {
-        access_violation_t error = {
-            .message = "Access violation.",
-            .address = info->si_addr,
-        };
-        throw(access_violation_t, error);
+        __libexcept_publish(event, subscribers);
     }
-    case SIGILL: {
-        if (info->si_code == ILL_BADSTK)
+
+    __libexcept_unlock_subscribers();
+    free(subscription);
+}
+
+// Kept separate from __libexcept_raise since __builtin_longjmp may not be used in the same function
+// as __builtin_setjmp. The hooks of an event share a single try block.
+static void __libexcept_dispatch(libexcept_event_t event, void (*hook)(void*))
+{
+    unsigned long long outer = __libexcept_enter_reader();
+
+    __libexcept_subscribers* subscribers = atomic_load(&__libexcept_subscribers_of[event]);
+    void* exception = __libexcept_current_exception();
+
+    // Exceptions are not expected to be thrown.
+    __LIBEXCEPT_TRY_BLOCK(0, 0)
+    {
+        if (hook != NULL)
         {
-            stack_corruption_error_t error = {
-                .message = "Internal stack error.",
-                .pc = info->si_addr,
-            };
-            throw(stack_corruption_error_t, error);
+            hook(exception);
         }
-        else
+        for (size_t i = 0; subscribers != NULL && i < subscribers->count; i++)
         {
-            illegal_instruction_error_t error = {
-                .message = "Illegal instruction.",
-                .pc = info->si_addr,
-            };
-            throw(illegal_instruction_error_t, error);
+            libexcept_subscription_t* subscription = subscribers->subscriptions[i];
+            subscription->hook(event, exception, subscription->context);
         }
     }
-
-    default:
-        abort();
+    __LIBEXCEPT_CATCH_ANY
+    {
+        __libexcept_leave_reader(outer);
+        __libexcept_unexpected();
     }
+
+    __libexcept_leave_reader(outer);
 }
 
-void libexcept_enable_sigcatch()
+static inline int __libexcept_has_hooks(libexcept_event_t event, void (*hook)(void*))
 {
-    struct sigaction sa;
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = __libexcept_handle_signal;
-    sigemptyset(&sa.sa_mask);
-
-    sigaction(SIGILL, &sa, NULL);
-    sigaction(SIGFPE, &sa, NULL);
-    sigaction(SIGSEGV, &sa, NULL);
-    sigaction(SIGBUS, &sa, NULL);
+    return ((uintptr_t)hook |
+            (uintptr_t)atomic_load_explicit(&__libexcept_subscribers_of[event],
+                                            memory_order_relaxed)) != 0;
 }
 
-void libexcept_disable_sigcatch()
+#ifdef LIBEXCEPT_SJLJ
+// Calls the defer blocks left by a throw, that is those entered since the try block it jumps to.
+// Kept separate from __libexcept_raise for the same reason as __libexcept_dispatch.
+static void __libexcept_run_deferred(__libexcept_state* state)
 {
-    signal(SIGILL, SIG_DFL);
-    signal(SIGFPE, SIG_DFL);
-    signal(SIGSEGV, SIG_DFL);
-    signal(SIGBUS, SIG_DFL);
+    __LIBEXCEPT_JMP_BUF* target = state->context;
+
+    // Deferred calls are not expected to throw.
+    __LIBEXCEPT_TRY_BLOCK(0, 0)
+    {
+        while (state->deferred != NULL && state->deferred->context == target)
+        {
+            __libexcept_deferred* deferred = state->deferred;
+            state->deferred = deferred->previous;
+            deferred->function(deferred->argument);
+        }
+    }
+    __LIBEXCEPT_CATCH_ANY
+    {
+        __libexcept_unexpected();
+    }
 }
 #endif
 
-jmp_buf** __libexcept_current_context()
+void __libexcept_rethrow()
 {
-#ifdef LIBEXCEPT_THREAD_AWARE
-    static thread_local __LIBEXCEPT_JMP_BUF* buffer;
-#else
-    static jmp_buf* buffer;
-#endif
-    return &buffer;
+    __LIBEXCEPT_COUNT(rethrows);
+    __libexcept_raise();
 }
 
-void __libexcept_throw(const char* id, size_t exception_size, void* exception)
+static void __libexcept_raise()
 {
-    // id is NULL only when rethrowing
-    if (id != NULL)
+    // Call the user defined handlers if possible.
+    if (__libexcept_has_hooks(LIBEXCEPT_EVENT_THROW, libexcept_on_throw))
     {
-        memcpy(current_exception, exception, exception_size);
-        current_id = id;
+        __libexcept_dispatch(LIBEXCEPT_EVENT_THROW, libexcept_on_throw);
     }
 
-    // Call the user defined handler if possible.
-    if (libexcept_on_throw != NULL)
+#ifdef LIBEXCEPT_UNWIND
+    // Only cleanups are run by the unwinder, so this is always forced unwinding. The landing pad of
+    // the nearest try block jumps out of it.
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    struct _Unwind_Exception* exception = &state->current->unwind_exception;
+    exception->exception_class = 0x4c49425843505400; // "LIBXCPT\0"
+    exception->exception_cleanup = __libexcept_delete_exception;
+    state->unwinding = 1;
+    _Unwind_ForcedUnwind(exception, __libexcept_unwind_stop, NULL);
+#else
+    // If this is NULL then we have reached the end of the chain.
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    if (state->context != NULL)
     {
-        // Exceptions are not expected to be thrown.
-        __LIBEXCEPT_TRY
+        if (state->deferred != NULL && state->deferred->context == state->context)
         {
-            libexcept_on_throw(current_exception);
+            __libexcept_run_deferred(state);
         }
-        __LIBEXCEPT_CATCH_ANY
+        __LIBEXCEPT_LONGJMP(*state->context, 1);
+    }
+#endif
+
+    __libexcept_unhandled();
+}
+
+int __libexcept_handled()
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    __libexcept_record* record = state->current;
+
+    __LIBEXCEPT_COUNT(catches);
+    __LIBEXCEPT_COUNT_TYPE(record->type, catches);
+    __libexcept_set_current(record->previous);
+    free(record->formatted);
+
+    // Release the record along with anything allocated after it.
+    state->top = record->top;
+    state->end = record->end;
+
+    // Once back to the initial buffer, no live exception remains in any of the chunks.
+    if (state->end == (char*)state->buffer + sizeof(state->buffer))
+    {
+        while (state->chunks != NULL)
         {
-            __libexcept_unexpected();
+            __libexcept_chunk* next = state->chunks->next;
+            free(state->chunks);
+            state->chunks = next;
         }
     }
 
-    // If this is NULL then we have reached the end of the chain.
-    if (*__libexcept_current_context() != NULL)
+    return 0;
+}
+
+static void __libexcept_print_exception(const char* kind)
+{
+    __libexcept_record* record = __LIBEXCEPT_TASK.current;
+
+    fprintf(stderr, "%s exception of type \"%s\"", kind, record->type->name);
+    if (record->site != NULL)
+    {
+        fprintf(stderr, " thrown at %s:%d in %s()", record->site->file, record->site->line,
+                record->site->function);
+    }
+    if (record->message != NULL)
     {
-        __LIBEXCEPT_LONGJMP(**__libexcept_current_context(), 1);
+        fprintf(stderr, ": %s", libexcept_exception_message());
     }
+    fputc('\n', stderr);
 
-    __libexcept_unhandled();
+#ifdef LIBEXCEPT_BACKTRACE
+    __libexcept_print_backtrace();
+#endif
 }
 
 void __libexcept_unhandled()
 {
-    // Call the user provided handler if possible.
-    if (libexcept_on_unhandled != NULL)
+    __LIBEXCEPT_COUNT(unhandled);
+
+    // Call the user provided handlers if possible.
+    if (__libexcept_has_hooks(LIBEXCEPT_EVENT_UNHANDLED, libexcept_on_unhandled))
     {
-        // Exceptions are not expected to be thrown.
-        __LIBEXCEPT_TRY
-        {
-            libexcept_on_unhandled(__libexcept_current_exception());
-        }
-        __LIBEXCEPT_CATCH_ANY
-        {
-            __libexcept_unexpected();
-        }
+        __libexcept_dispatch(LIBEXCEPT_EVENT_UNHANDLED, libexcept_on_unhandled);
     }
-    else
+
+    if (libexcept_on_unhandled == NULL)
     {
-        fprintf(stderr, "Unhandled exception of type \"%s\"\n", current_id);
+        __libexcept_print_exception("Unhandled");
     }
 
 #ifdef LIBEXCEPT_THREAD_AWARE
@@ -218,23 +3234,25 @@ void __libexcept_unhandled()
 
 void __libexcept_unexpected()
 {
-    // Call the user provided handler if possible.
-    if (libexcept_on_unexpected != NULL)
+    __LIBEXCEPT_COUNT(unexpected);
+
+    // If a handler throws we end up here again, in which case only the default message is printed.
+    int handled = 0;
+    if (!__LIBEXCEPT_TASK.unexpected)
     {
-        __LIBEXCEPT_TRY
-        {
-            libexcept_on_unexpected(current_exception);
-        }
-        __LIBEXCEPT_CATCH_ANY
+        __LIBEXCEPT_TASK.unexpected = 1;
+
+        // Call the user provided handlers if possible.
+        if (__libexcept_has_hooks(LIBEXCEPT_EVENT_UNEXPECTED, libexcept_on_unexpected))
         {
-            // If an exception occurs, reset the handler and try again.
-            libexcept_on_unexpected = NULL;
-            __libexcept_unexpected();
+            __libexcept_dispatch(LIBEXCEPT_EVENT_UNEXPECTED, libexcept_on_unexpected);
         }
+        handled = libexcept_on_unexpected != NULL;
     }
-    else
+
+    if (!handled)
     {
-        fprintf(stderr, "Unexpected exception of type \"%s\"\n", current_id);
+        __libexcept_print_exception("Unexpected");
     }
 
 #ifdef LIBEXCEPT_THREAD_AWARE
@@ -244,14 +3262,39 @@ void __libexcept_unexpected()
 #endif
 }
 
-void* __libexcept_current_exception()
+const libexcept_type_t* libexcept_exception_type()
 {
-    return current_exception;
+    return __LIBEXCEPT_TASK.current != NULL ? __LIBEXCEPT_TASK.current->type : NULL;
+}
+
+const char* libexcept_exception_message()
+{
+    __libexcept_record* record = __LIBEXCEPT_TASK.current;
+
+    if (record == NULL || record->message == NULL)
+    {
+        return NULL;
+    }
+
+    // The formatted message is allocated on the heap rather than in the arena, since another
+    // exception may be under construction right after this one.
+    if (record->formatted == NULL)
+    {
+        size_t size = libexcept_format_message(record->message, NULL, 0) + 1;
+        record->formatted = malloc(size);
+        if (record->formatted == NULL)
+        {
+            return record->message->format;
+        }
+        libexcept_format_message(record->message, record->formatted, size);
+    }
+
+    return record->formatted;
 }
 
-int __libexcept_personality(const char* id)
+const libexcept_site_t* libexcept_exception_site()
 {
-    return strcmp(current_id, id) == 0;
+    return __LIBEXCEPT_TASK.current != NULL ? __LIBEXCEPT_TASK.current->site : NULL;
 }
 
 void (*libexcept_on_throw)(void*);
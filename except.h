@@ -52,10 +52,20 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fenv.h>
 #include <setjmp.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdnoreturn.h>
 
+#ifdef LIBEXCEPT_SIGNAL_AWARE
+#include <sys/types.h>
+#endif
+
+#ifdef __cplusplus
+#error "except.h can only be included from C"
+#endif
+
 /**
  * @defgroup keywords Exception handling keywords.
  *
@@ -96,6 +106,79 @@
  * throw: Throws an exception. Execution of the current function immediately halts.
  * rethrow: Re-throws an exception caught in a catch block. This will preserve the original
  *          exception object.
+ * throw_message: Throws an object with a libexcept_message_t member named message, which is set
+ *                to a printf style format and its arguments. See libexcept_message_t.
+ * checked_fp: Runs the following block with floating point traps disabled and, once it completes,
+ *             throws an arithmetic_error_t if it raised any of the floating point exceptions in
+ *             LIBEXCEPT_FP_EXCEPTIONS. The flags are checked once for the whole block instead of
+ *             trapping on every faulting instruction, so vectorized loops run at full speed.
+ * defer: Runs the following block and then calls a function with an argument, also when the block
+ *        is left because of an exception. It does the job of a finally clause without a try block,
+ *        so entering it neither saves a context nor runs the stages of a try block.
+ * try_deadline: Like try, except that it takes a number of nanoseconds after which a
+ *               deadline_exceeded_t is thrown into the block if it is still running. Only
+ *               available with LIBEXCEPT_DEADLINES, see the deadlines group.
+ *
+ * Thrown objects are stored in a per-thread arena and released once they are handled, so there is
+ * no limit on their size. Two variants avoid copying them altogether:
+ *
+ * throw_new: Allocates an uninitialized object in the arena, runs the following block to construct
+ *            it in place and then throws it.
+ * catch_ref: Like catch, except that it binds a pointer to the thrown object instead of a copy. The
+ *            pointer is valid until the end of the catch block.
+ *
+ * @code
+ *
+ * throw_new (parse_error_t, error)
+ * {
+ *     error->line = line;
+ *     snprintf(error->context, sizeof(error->context), "%s", input);
+ * }
+ *
+ * try { ... }
+ * catch_ref (parse_error_t, error) { puts(error->context); }
+ *
+ * @endcode
+ *
+ * A checked_fp block restores the floating point environment it was entered with, including any
+ * flags raised before it, when it completes. Leaving it with break, return, goto or an exception
+ * skips that and leaves traps disabled. Code relying on the flags should be compiled with
+ * `#pragma STDC FENV_ACCESS ON` where supported.
+ *
+ * @code
+ *
+ * try
+ * {
+ *     checked_fp
+ *     {
+ *         for (size_t i = 0; i < n; i++)
+ *         {
+ *             y[i] = a * x[i] / z[i];
+ *         }
+ *     }
+ * }
+ * catch (arithmetic_error_t, error) { puts(error.message); }
+ *
+ * @endcode
+ *
+ * The function of a defer block is called after the block completes or, when an exception is
+ * thrown out of it, before control reaches the catch clauses that handle it. Calls of nested blocks
+ * are made innermost first. The function must not throw and the block must not be left with break,
+ * return, goto or rethrow, which skips the call.
+ *
+ * @code
+ *
+ * char* buffer = malloc(size);
+ * defer (free, buffer)
+ * {
+ *     read_into(buffer, size);
+ * }
+ *
+ * @endcode
+ *
+ * As with setjmp, a local variable that is changed inside a try block and read after an exception
+ * was thrown out of it must be declared volatile. Unless libexcept is built with
+ * LIBEXCEPT_LIGHTWEIGHT_CONTEXT, its value is otherwise unspecified once the exception is caught.
  *
  * If any of these keyword macros interfere with other symbol names, you may choose to prevent their
  * definition. This can be done by defining the LIBEXCEPT_NO_KEYWORDS macro. The same constructs can
@@ -103,10 +186,26 @@
  *
  * __LIBEXCEPT_TRY
  * __LIBEXCEPT_CATCH
+ * __LIBEXCEPT_CATCH_REF
  * __LIBEXCEPT_CATCH_ANY
  * __LIBEXCEPT_FINALLY
  * __LIBEXCEPT_THROW
+ * __LIBEXCEPT_THROW_NEW
+ * __LIBEXCEPT_THROW_MESSAGE
  * __LIBEXCEPT_RETHROW
+ * __LIBEXCEPT_CHECKED_FP
+ * __LIBEXCEPT_DEFER
+ * __LIBEXCEPT_TRY_DEADLINE
+ *
+ * except.h can only be included from C. In C++ the clauses would have to become the handlers of a
+ * native try, which must follow it directly and can not express finally.
+ *
+ * With LIBEXCEPT_UNWIND, exceptions cross frames of other languages compiled with unwind tables,
+ * such as C++ called from C, and run their cleanups. Exceptions thrown by those languages pass
+ * through try blocks without running their clauses, finally included. The landing pad of a try
+ * block has no access to the foreign exception it is unwinding, so it could not resume unwinding it
+ * after jumping back into the block. Cleanup that must also run for them belongs in a defer block,
+ * which the unwinder runs for every exception.
  *
  * @{
  */
@@ -114,10 +213,18 @@
 #ifndef LIBEXCEPT_NO_KEYWORDS
 #define try __LIBEXCEPT_TRY
 #define catch __LIBEXCEPT_CATCH
+#define catch_ref __LIBEXCEPT_CATCH_REF
 #define catch_any __LIBEXCEPT_CATCH_ANY
 #define finally   __LIBEXCEPT_FINALLY
 #define throw __LIBEXCEPT_THROW
+#define throw_new __LIBEXCEPT_THROW_NEW
+#define throw_message __LIBEXCEPT_THROW_MESSAGE
 #define rethrow __LIBEXCEPT_RETHROW
+#define checked_fp __LIBEXCEPT_CHECKED_FP
+#define defer __LIBEXCEPT_DEFER
+#ifdef LIBEXCEPT_DEADLINES
+#define try_deadline __LIBEXCEPT_TRY_DEADLINE
+#endif
 #endif
 
 /**
@@ -125,218 +232,2026 @@
  */
 
 /**
- * The maximum size of an object allowed to be thrown.
+ * The floating point exceptions that checked_fp blocks throw for. This may be defined before
+ * including except.h or redefined between blocks, for example to FE_ALL_EXCEPT to also throw for
+ * inexact results and underflows.
  */
-#define LIBEXCEPT_MAX_THROWABLE_SIZE 128
+#ifndef LIBEXCEPT_FP_EXCEPTIONS
+#define LIBEXCEPT_FP_EXCEPTIONS (FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW)
+#endif
 
 /**
- * @defgroup event_hooks Event hooks.
+ * The size of the per-thread buffer that thrown objects are allocated from. Larger or nested
+ * exceptions that do not fit are allocated from the heap instead.
+ */
+#define LIBEXCEPT_ARENA_SIZE 1024
+
+/**
+ * @defgroup types Exception types.
  *
- * libexcept provides hooks for some events. They are global to the program and not thread-safe to
- * set or unset. They are intended to be set just after entering main.
+ * Every type that is thrown or caught needs a descriptor, whose address identifies the type so that
+ * matching a catch clause is a single pointer comparison. A type shared between translation units
+ * is declared with LIBEXCEPT_DECLARE_TYPE in the header that defines it and its descriptor is
+ * defined with LIBEXCEPT_DEFINE_TYPE in exactly one source file. A type used by a single
+ * translation unit can instead be declared with LIBEXCEPT_LOCAL_TYPE, which gives it a descriptor
+ * of its own. Two different types with the same name therefore never share a descriptor: they are
+ * either local to their translation units or their definitions collide when linking.
  *
- * The default implementations just print a simple message to stderr. To restore the default
- * implementations just set these back to NULL.
+ * Type names have to be single identifiers. The built-in arithmetic types are declared by this
+ * header, including those spelled with several keywords such as unsigned long or long double.
+ * Other types, such as struct foo or pointers, should be given a typedef name first.
  *
- * Ideally these functions should just perform some logging or set a flag and return. If any of
- * these throw an exception then the default unexpected handler is called and the program is
- * terminated. If these function never return to their callers then the behavior is undefined. It is
- * up to the programmer to ensure correct use.
+ * Types can form hierarchies by being declared with LIBEXCEPT_DECLARE_SUBTYPE instead, in which
+ * case catch clauses for a type also catch all types derived from it.
+ *
+ * @code
+ *
+ * // In file_not_found.h.
+ * typedef struct
+ * {
+ *     const char* path;
+ * } file_not_found_t;
+ *
+ * LIBEXCEPT_DECLARE_TYPE(file_not_found_t);
+ *
+ * // In file_not_found.c.
+ * LIBEXCEPT_DEFINE_TYPE(file_not_found_t);
+ *
+ * @endcode
  *
  * @{
  */
 
 /**
- * Called whenever an exception is thrown.
- *
- * @param exception The exception that was thrown.
+ * The maximum depth of a type hierarchy. A type declared with LIBEXCEPT_DECLARE_TYPE has depth 0
+ * and each LIBEXCEPT_DECLARE_SUBTYPE adds one to the depth of its base.
  */
-extern void (*libexcept_on_throw)(void* exception);
+#define LIBEXCEPT_MAX_TYPE_DEPTH 8
 
 /**
- * Called whenever an exception is never caught.
+ * Describes a type that can be thrown and caught.
+ */
+typedef struct libexcept_type
+{
+    const char* name;
+    const struct libexcept_type* base;
+    int depth;
+} libexcept_type_t;
+
+/**
+ * Declares T as an exception type whose descriptor is defined with LIBEXCEPT_DEFINE_TYPE in a
+ * single source file. This is meant for headers, so that every translation unit shares the
+ * descriptor.
+ */
+#define LIBEXCEPT_DECLARE_TYPE(T)                                                                  \
+    enum                                                                                           \
+    {                                                                                              \
+        __LIBEXCEPT_TYPE_DEPTH(T) = 0                                                              \
+    };                                                                                             \
+    __LIBEXCEPT_DECLARE_DESCRIPTOR(T)
+
+/**
+ * Defines the descriptor of a type declared with LIBEXCEPT_DECLARE_TYPE.
+ */
+#define LIBEXCEPT_DEFINE_TYPE(T)                                                                   \
+    __LIBEXCEPT_DEFINE_DESCRIPTOR(T) = {.name = #T, .base = NULL, .depth = 0}
+
+/**
+ * Declares T as an exception type of the current translation unit only. Its descriptor has internal
+ * linkage, so a type with the same name in another translation unit is a different type.
+ */
+#define LIBEXCEPT_LOCAL_TYPE(T)                                                                    \
+    enum                                                                                           \
+    {                                                                                              \
+        __LIBEXCEPT_TYPE_DEPTH(T) = 0                                                              \
+    };                                                                                             \
+    static const libexcept_type_t __LIBEXCEPT_TYPE_DESCRIPTOR(T) = {                               \
+        .name = #T,                                                                                \
+        .base = NULL,                                                                              \
+        .depth = 0,                                                                                \
+    }
+
+/**
+ * Declares T as an exception type derived from Base, which must already be declared. Catch clauses
+ * for Base also catch T, so T should begin with the members of Base (for example by having a Base
+ * as its first member) for catching by the base type to be meaningful. Checking whether a thrown
+ * type derives from a caught one takes constant time regardless of the depth of the hierarchy.
  *
- * @param exception The exception that was thrown.
+ * @code
+ *
+ * typedef struct
+ * {
+ *     const char* message;
+ * } io_error_t;
+ *
+ * typedef struct
+ * {
+ *     io_error_t base;
+ *     const char* path;
+ * } file_not_found_t;
+ *
+ * LIBEXCEPT_DECLARE_TYPE(io_error_t);
+ * LIBEXCEPT_DECLARE_SUBTYPE(file_not_found_t, io_error_t);
+ *
+ * // In a single source file.
+ * LIBEXCEPT_DEFINE_TYPE(io_error_t);
+ * LIBEXCEPT_DEFINE_SUBTYPE(file_not_found_t, io_error_t);
+ *
+ * try { throw(file_not_found_t, {.path = "/etc/foo"}); }
+ * catch (io_error_t, error) { ... }
+ *
+ * @endcode
  */
-extern void (*libexcept_on_unhandled)(void* exception);
+#define LIBEXCEPT_DECLARE_SUBTYPE(T, Base)                                                         \
+    __LIBEXCEPT_SUBTYPE_DEPTH(T, Base);                                                            \
+    __LIBEXCEPT_DECLARE_DESCRIPTOR(T)
 
 /**
- * Called whenever an exception is thrown from a catch or finally clause or from any of the user
- * defined event handlers.
+ * Defines the descriptor of a type declared with LIBEXCEPT_DECLARE_SUBTYPE.
+ */
+#define LIBEXCEPT_DEFINE_SUBTYPE(T, Base)                                                          \
+    __LIBEXCEPT_DEFINE_DESCRIPTOR(T) = {                                                           \
+        .name = #T,                                                                                \
+        .base = LIBEXCEPT_TYPE(Base),                                                              \
+        .depth = __LIBEXCEPT_TYPE_DEPTH(T),                                                        \
+    }
+
+/**
+ * Declares T as an exception type derived from Base of the current translation unit only, as
+ * LIBEXCEPT_LOCAL_TYPE does.
+ */
+#define LIBEXCEPT_LOCAL_SUBTYPE(T, Base)                                                           \
+    __LIBEXCEPT_SUBTYPE_DEPTH(T, Base);                                                            \
+    static const libexcept_type_t __LIBEXCEPT_TYPE_DESCRIPTOR(T) = {                               \
+        .name = #T,                                                                                \
+        .base = LIBEXCEPT_TYPE(Base),                                                              \
+        .depth = __LIBEXCEPT_TYPE_DEPTH(T),                                                        \
+    }
+
+/**
+ * Evaluates to a pointer to the descriptor of T.
+ */
+#define LIBEXCEPT_TYPE(T) __LIBEXCEPT_TYPE_BY(__LIBEXCEPT_IS_KEYWORD(__LIBEXCEPT_KEYWORD_##T), T)
+
+/**
+ * Returns the descriptor of the exception currently being thrown or handled. This is mostly
+ * useful in event hooks for diagnostic purposes.
  *
- * @param exception The exception that was thrown.
+ * @return The descriptor of the current exception or NULL if there is none.
  */
-extern void (*libexcept_on_unexpected)(void* exception);
+const libexcept_type_t* libexcept_exception_type();
 
 /**
  * @}
  */
 
-#ifdef LIBEXCEPT_SIGNAL_AWARE
 /**
- * Enables transforming of signals to exceptions.
+ * @defgroup sites Throw sites.
+ *
+ * Every throw statement has a descriptor with the location of the statement, which is a constant
+ * emitted by the compiler. Throwing only stores its address, so this costs nothing at run time. The
+ * location is reported by the default handlers and can be queried with libexcept_exception_site.
+ *
+ * Each site also has a severity, which is not used by libexcept itself but can be used by the event
+ * hooks to decide how to report an exception. It is taken from LIBEXCEPT_THROW_SEVERITY, which can
+ * be redefined before the throw statements it should apply to.
+ *
+ * @code
+ *
+ * #undef LIBEXCEPT_THROW_SEVERITY
+ * #define LIBEXCEPT_THROW_SEVERITY LIBEXCEPT_SEVERITY_WARNING
+ *
+ * throw(cache_miss_t, {.key = key});
+ *
+ * @endcode
+ *
+ * @{
  */
-void libexcept_enable_sigcatch();
 
 /**
- * Disables transforming of signals to exceptions.
+ * Severities of throw sites.
  */
-void libexcept_disable_sigcatch();
+typedef enum
+{
+    LIBEXCEPT_SEVERITY_INFO,
+    LIBEXCEPT_SEVERITY_WARNING,
+    LIBEXCEPT_SEVERITY_ERROR,
+    LIBEXCEPT_SEVERITY_FATAL,
+} libexcept_severity_t;
 
+#ifndef LIBEXCEPT_THROW_SEVERITY
 /**
- * Thrown whenever an arithmetic related error (such as division by zero) occurs. This error
- * directly coresponds to SIGFPE. Although these errors are probably due to buggy code, they are
- * most likely not fatal and safe to catch.
+ * The severity of the throw statements that follow.
  */
-typedef struct
-{
-    const char* message;
-    void* pc;
-} arithmetic_error_t;
+#define LIBEXCEPT_THROW_SEVERITY LIBEXCEPT_SEVERITY_ERROR
+#endif
 
 /**
- * Thrown whenever an illegal, privileged or malformed instruction is executed. This error directly
- * coresponds to SIGILL. These errors should never happen under normal circumstances and their
- * occurrence is usually fatal. It is not advised to handle these sorts of errors.
+ * Describes a throw statement.
  */
 typedef struct
 {
-    const char* message;
-    void* pc;
-} illegal_instruction_error_t;
+    const libexcept_type_t* type;
+    const char* file;
+    int line;
+    const char* function;
+    libexcept_severity_t severity;
+} libexcept_site_t;
 
 /**
- * Thrown whenever the stack is corrupted (for example on stack overflow). This error roughly
- * coresponds to SIGILL. This error is fatal.
+ * Returns the site that threw the exception currently being thrown or handled. Rethrowing an
+ * exception does not change its site.
+ *
+ * Sites are not available for exceptions thrown with throw_new on compilers other than GCC and
+ * Clang.
+ *
+ * @return The site of the current exception or NULL if there is none.
  */
-typedef struct
-{
-    const char* message;
-    void* pc;
-} stack_corruption_error_t;
+const libexcept_site_t* libexcept_exception_site();
 
 /**
- * Thrown whenever a program tries to access memory which it does not have ownership of. This error
- * coresponds to SIGSEGV and some instances of SIGBUS. This error usually means an invalid or NULL
- * pointer was dereferenced. This is the cause of a serious program bug and should not be handled.
+ * @}
  */
-typedef struct
-{
-    const char* message;
-    void* address;
-} access_violation_t;
 
 /**
- * This is thrown on some occasions when a program dereferences a pointer not properly aligned for
- * the data type it points to. Sometimes this may manifest itself as an access_violation_t. It
- * corresponds to some instances of SIGBUS. As with access_violation_t it is a result of buggy code
- * and should not be handled.
+ * @defgroup messages Messages.
+ *
+ * Exceptions can carry messages which are only formatted when they are needed, since most
+ * exceptions are caught without ever looking at their message. throw_message stores the format and
+ * the raw values of its arguments in the exception, which costs a pass over the format but no
+ * conversions. The message is formatted by libexcept_exception_message, or by the default handlers
+ * if the exception is not caught.
+ *
+ * The format follows printf, except that %n is ignored. Strings are not copied, so they have to
+ * remain valid for as long as the exception is in use. At most LIBEXCEPT_MESSAGE_ARGUMENTS values
+ * are stored (a * width or precision counts as one) and the message ends at the conversion that
+ * did not fit.
+ *
+ * @code
+ *
+ * typedef struct
+ * {
+ *     libexcept_message_t message;
+ *     int fd;
+ * } io_error_t;
+ *
+ * LIBEXCEPT_DECLARE_TYPE(io_error_t);
+ *
+ * throw_message (io_error_t, "read of %zu bytes at offset %lld failed", size, (long long)offset);
+ *
+ * try { ... }
+ * catch (io_error_t, error) { puts(libexcept_exception_message()); }
+ *
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * The maximum number of values stored in a message.
+ */
+#define LIBEXCEPT_MESSAGE_ARGUMENTS 8
+
+/**
+ * A format and its unformatted arguments.
  */
 typedef struct
 {
-    const char* message;
-    void* address;
-} misaligned_access_error_t;
-#endif
+    const char* format;
+    int count;
+    union
+    {
+        intmax_t i;
+        uintmax_t u;
+        long double f;
+        const void* p;
+    } arguments[LIBEXCEPT_MESSAGE_ARGUMENTS];
+} libexcept_message_t;
 
-/*
-  End of public API.
+/**
+ * Returns the formatted message of the exception currently being thrown or handled. The message is
+ * only formatted once and remains valid until the exception is handled.
+ *
+ * @return The message or NULL if the exception was not thrown with throw_message.
  */
+const char* libexcept_exception_message();
 
-#ifdef LIBEXCEPT_SIGNAL_AWARE
-#define __LIBEXCEPT_JMP_BUF        jmp_buf
-#define __LIBEXCEPT_SETJMP(buffer) sigsetjmp(buffer, 1)
-#define __LIBEXCEPT_LONGJMP        siglongjmp
-#else
-#define __LIBEXCEPT_JMP_BUF        sigjmp_buf
-#define __LIBEXCEPT_SETJMP(buffer) setjmp(buffer)
-#define __LIBEXCEPT_LONGJMP        longjmp
-#endif
+/**
+ * Formats a message, for example one copied from an exception that has already been handled.
+ *
+ * @param message The message to format.
+ * @param buffer Where to store the message, which is always null terminated if size is not 0.
+ * @param size The size of buffer.
+ * @return The length of the whole message, which may be larger than the part stored in buffer.
+ */
+size_t libexcept_format_message(const libexcept_message_t* message, char* buffer, size_t size);
 
-#define __LIBEXCEPT_STAGE_TRY        0
-#define __LIBEXCEPT_STAGE_CATCH      1
-#define __LIBEXCEPT_STAGE_FINALLY    2
-#define __LIBEXCEPT_STAGE_PROPAGATE  3
-#define __LIBEXCEPT_STAGE_UNEXPECTED -1
-#define __LIBEXCEPT_UNIQUE(var)      __LIBEXCEPT_CONCAT(__libexcept_##var, __LINE__)
-#define __LIBEXCEPT_CONCAT(a, b)     __LIBEXCEPT_CONCAT_(a, b)
-#define __LIBEXCEPT_CONCAT_(a, b)    a##b
-#define __LIBEXCEPT_THROW(T, ...)                                                                  \
-    __libexcept_throw(__LIBEXCEPT_TYPE_NAME(T), sizeof(T), (T[1]){__VA_ARGS__});                   \
-    static_assert(sizeof(T) <= LIBEXCEPT_MAX_THROWABLE_SIZE,                                       \
-                  "Throwable object size exceeds the maximum supported by libexcept")
-#define __LIBEXCEPT_RETHROW() break
+/**
+ * @}
+ */
+
+/**
+ * @defgroup event_hooks Event hooks.
+ *
+ * libexcept provides hooks for some events. There are two ways to install them:
+ *
+ * - The libexcept_on_* function pointers hold a single hook per event. They are global to the
+ *   program and not thread-safe to set or unset, so they are intended to be set just after entering
+ *   main. The unhandled and unexpected hooks replace the default implementations, which just print
+ *   a simple message to stderr. To restore the default implementations just set these back to NULL.
+ * - Any number of hooks can be subscribed to an event with libexcept_subscribe and removed with
+ *   libexcept_unsubscribe, at any time and from any thread. Subscribers only observe events, so the
+ *   default messages are still printed. Throwing threads never take a lock to call them.
+ *
+ * Ideally these functions should just perform some logging or set a flag and return. If any of
+ * these throw an exception then the remaining hooks for the event are skipped, the default
+ * unexpected handler is called and the program is terminated. If these function never return to
+ * their callers then the behavior is undefined. Hooks may not subscribe or unsubscribe hooks
+ * themselves. It is up to the programmer to ensure correct use.
+ *
+ * @{
+ */
 
-#define __LIBEXCEPT_TYPE_NAME(T)                                                                   \
-    _Generic((T){0}, signed char                                                                   \
-             : "schar", unsigned char                                                              \
-             : "uchar", char                                                                       \
-             : "char", short                                                                       \
-             : "short", unsigned short                                                             \
-             : "ushort", int                                                                       \
-             : "int", unsigned int                                                                 \
-             : "uint", long                                                                        \
-             : "long", unsigned long                                                               \
-             : "ulong", long long                                                                  \
-             : "longlong", unsigned long long                                                      \
-             : "ulonglong", float                                                                  \
-             : "float", double                                                                     \
-             : "double", long double                                                               \
-             : "ldbl", default                                                                     \
-             : #T)
+/**
+ * The events hooks can be subscribed to.
+ */
+typedef enum
+{
+    /** An exception is thrown or rethrown. */
+    LIBEXCEPT_EVENT_THROW,
+    /** An exception is never caught. */
+    LIBEXCEPT_EVENT_UNHANDLED,
+    /** An exception is thrown from a catch or finally clause or from a hook. */
+    LIBEXCEPT_EVENT_UNEXPECTED,
+} libexcept_event_t;
 
-#define __LIBEXCEPT_TRY                                                                            \
-    __LIBEXCEPT_JMP_BUF __LIBEXCEPT_UNIQUE(local_buffer);                                          \
-    __LIBEXCEPT_JMP_BUF* __LIBEXCEPT_UNIQUE(old_buffer) = *__libexcept_current_context();          \
-    *__libexcept_current_context() = &__LIBEXCEPT_UNIQUE(local_buffer);                            \
-    for (int __libexcept_stage = 0,                                                                \
-             __libexcept_error = __LIBEXCEPT_SETJMP(__LIBEXCEPT_UNIQUE(local_buffer));             \
-         __libexcept_stage < 4;                                                                    \
-         __libexcept_stage++)                                                                      \
-        if (__libexcept_stage == __LIBEXCEPT_STAGE_PROPAGATE)                                      \
-        {                                                                                          \
-            *__libexcept_current_context() = __LIBEXCEPT_UNIQUE(old_buffer);                       \
-            if (__libexcept_error != 0)                                                            \
-            {                                                                                      \
-                __libexcept_throw(NULL, 0, NULL);                                                  \
-            }                                                                                      \
-        }                                                                                          \
-        else if (__libexcept_stage == __LIBEXCEPT_STAGE_UNEXPECTED)                                \
-        {                                                                                          \
-            __libexcept_unexpected();                                                              \
-        }                                                                                          \
-        else if (__libexcept_stage == __LIBEXCEPT_STAGE_TRY && __libexcept_error == 0)
+#define LIBEXCEPT_EVENT_COUNT 3
 
-#define __LIBEXCEPT_CATCH(T, var)                                                                  \
-    else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && __libexcept_error != 0 &&             \
-             __libexcept_personality(__LIBEXCEPT_TYPE_NAME(T)))                                    \
-        __LIBEXCEPT_UNEXPECTED_LOOP(                                                               \
-            __LIBEXCEPT_STAGE_CATCH) for (T var = *(T*)__libexcept_current_exception();            \
-                                          __libexcept_error != 0;                                  \
-                                          __libexcept_error = 0)
+/**
+ * A hook subscribed with libexcept_subscribe.
+ *
+ * @param event The event that occurred.
+ * @param exception The current exception.
+ * @param context The context given to libexcept_subscribe.
+ */
+typedef void (*libexcept_hook_t)(libexcept_event_t event, void* exception, void* context);
 
-#define __LIBEXCEPT_CATCH_ANY                                                                      \
-    else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && __libexcept_error != 0)               \
-        __LIBEXCEPT_UNEXPECTED_LOOP(__LIBEXCEPT_STAGE_CATCH) for (; __libexcept_error != 0;        \
-                                                                  __libexcept_error = 0)
+typedef struct libexcept_subscription libexcept_subscription_t;
 
-#define __LIBEXCEPT_FINALLY                                                                        \
-    else if (__libexcept_stage == __LIBEXCEPT_STAGE_FINALLY)                                       \
-        __LIBEXCEPT_UNEXPECTED_LOOP(__LIBEXCEPT_STAGE_FINALLY)
+/**
+ * Subscribes a hook to an event. The hook is called for events occurring in any thread after this
+ * function returns, after the libexcept_on_* hook for the event and the previous subscribers.
+ *
+ * @param event The event.
+ * @param hook The hook.
+ * @param context Passed to the hook.
+ * @return A subscription to pass to libexcept_unsubscribe or NULL if out of memory.
+ */
+libexcept_subscription_t* libexcept_subscribe(libexcept_event_t event, libexcept_hook_t hook,
+                                              void* context);
 
-#define __LIBEXCEPT_UNEXPECTED_LOOP(stage)                                                         \
-    for (__libexcept_stage = __LIBEXCEPT_STAGE_UNEXPECTED; __libexcept_stage != stage;             \
-         __libexcept_stage = stage)
+/**
+ * Removes a subscription. Once this returns the hook is no longer running in any thread, so its
+ * context may be freed.
+ *
+ * @param subscription The subscription returned by libexcept_subscribe.
+ */
+void libexcept_unsubscribe(libexcept_subscription_t* subscription);
 
-/*
-  Calls to these are inserted automatically by the macro system. Direct usage is not intended.
+/**
+ * Called whenever an exception is thrown.
+ *
+ * @param exception The exception that was thrown.
+ */
+extern void (*libexcept_on_throw)(void* exception);
+
+/**
+ * Called whenever an exception is never caught.
+ *
+ * @param exception The exception that was thrown.
  */
+extern void (*libexcept_on_unhandled)(void* exception);
 
-__LIBEXCEPT_JMP_BUF** __libexcept_current_context();
-noreturn void __libexcept_throw(const char*, size_t, void*);
-noreturn void __libexcept_unexpected();
-noreturn void __libexcept_unhandled();
-int __libexcept_personality(const char*);
-void* __libexcept_current_exception();
+/**
+ * Called whenever an exception is thrown from a catch or finally clause or from any of the user
+ * defined event handlers.
+ *
+ * @param exception The exception that was thrown.
+ */
+extern void (*libexcept_on_unexpected)(void* exception);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup captured_exceptions Captured exceptions.
+ *
+ * The current exception can be captured in order to be rethrown later, possibly in another thread.
+ * A captured exception keeps a copy of the thrown object along with its type, throw site and
+ * message, so that it is rethrown with its original type. Captured exceptions are reference
+ * counted and may be retained, released and rethrown from any thread.
+ *
+ * A thread pool could capture the exception of a failed task so that it is rethrown by the thread
+ * waiting for the result of the task:
+ *
+ * @code
+ * try
+ * {
+ *     task->function(task->argument);
+ * }
+ * catch_any
+ * {
+ *     task->error = libexcept_capture();
+ * }
+ *
+ * // Later, in the waiting thread.
+ * if (task->error != NULL)
+ * {
+ *     libexcept_rethrow_captured(task->error);
+ * }
+ * @endcode
+ *
+ * @{
+ */
+
+typedef struct libexcept_captured libexcept_captured_t;
+
+/**
+ * Captures the exception currently being handled. The result holds one reference.
+ *
+ * @return The captured exception or NULL if there is no current exception or out of memory.
+ */
+libexcept_captured_t* libexcept_capture();
+
+/**
+ * Adds a reference to a captured exception.
+ *
+ * @param captured The captured exception.
+ * @return The captured exception.
+ */
+libexcept_captured_t* libexcept_retain(libexcept_captured_t* captured);
+
+/**
+ * Removes a reference from a captured exception, freeing it when none are left.
+ *
+ * @param captured The captured exception or NULL.
+ */
+void libexcept_release(libexcept_captured_t* captured);
+
+/**
+ * Throws a copy of a captured exception in the calling thread, consuming one reference. To keep the
+ * captured exception for later use, retain it first.
+ *
+ * @param captured The captured exception.
+ */
+noreturn void libexcept_rethrow_captured(libexcept_captured_t* captured);
+
+/**
+ * Gets the type of a captured exception.
+ *
+ * @param captured The captured exception.
+ * @return The type of the captured exception.
+ */
+const libexcept_type_t* libexcept_captured_type(const libexcept_captured_t* captured);
+
+/**
+ * Gets the thrown object of a captured exception.
+ *
+ * @param captured The captured exception.
+ * @return The captured copy of the thrown object.
+ */
+const void* libexcept_captured_value(const libexcept_captured_t* captured);
+
+/**
+ * @}
+ */
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+/**
+ * @defgroup parallel Parallel loops and task groups.
+ *
+ * Tasks run on a pool of worker threads shared by the whole process, which is started on first use
+ * and grows while tasks are waiting and no worker is idle. It has a worker for every processor but
+ * one, or more if a parallel loop asks for more threads. The threads of the pool are never joined.
+ *
+ * A task group collects the tasks spawned into it with libexcept_spawn and
+ * libexcept_wait_task_group waits for all of them. While waiting, the calling thread runs the
+ * tasks of the group that no worker has taken yet, so groups may be nested. libexcept_parallel_for
+ * runs a task for every index of a range in a group of its own. The calling thread and the workers
+ * each start with an equal share of the range and, once done with their own share, take indices
+ * from the shares of others.
+ *
+ * When a task throws, no more tasks of its group are started and tasks that are already running
+ * are expected to return early by checking libexcept_cancelled. Once every task is done, the
+ * exception is rethrown in the waiting thread. The exceptions of tasks that failed at the same time
+ * can also be collected into an aggregate_error_t:
+ *
+ * @code
+ * void process(size_t index, void* argument)
+ * {
+ *     struct batch* batch = argument;
+ *     for (size_t i = 0; i < batch->items[index].length && !libexcept_cancelled(); i++)
+ *     {
+ *         ...
+ *     }
+ * }
+ *
+ * try
+ * {
+ *     libexcept_parallel_for(batch.count, process, &batch, 0, LIBEXCEPT_FAIL_AGGREGATE);
+ * }
+ * catch (aggregate_error_t, error)
+ * {
+ *     fprintf(stderr, "%zu items failed\n", error.count);
+ *     libexcept_release_aggregate(&error);
+ * }
+ * @endcode
+ *
+ * A group also fails when the pool needs another worker for one of its tasks but can not start it,
+ * as if a task had thrown an int holding ENOMEM or EAGAIN. The task itself is then not run.
+ *
+ * @{
+ */
+
+/**
+ * A task run by libexcept_parallel_for or spawned into a task group.
+ *
+ * @param index The index the task is run for.
+ * @param argument The argument given along with the task.
+ */
+typedef void (*libexcept_task_t)(size_t index, void* argument);
+
+/**
+ * What is thrown when the tasks of a group fail.
+ */
+typedef enum
+{
+    /** Rethrow the exception of the first task that failed. */
+    LIBEXCEPT_FAIL_FIRST,
+    /** Throw an aggregate_error_t holding the exceptions of all tasks that failed. */
+    LIBEXCEPT_FAIL_AGGREGATE,
+} libexcept_failure_t;
+
+/**
+ * The maximum number of exceptions kept by an aggregate_error_t.
+ */
+#define LIBEXCEPT_AGGREGATE_ERRORS 16
+
+/**
+ * Thrown by libexcept_parallel_for and libexcept_wait_task_group when tasks fail. The errors must
+ * be released with libexcept_release_aggregate by whoever catches this.
+ */
+typedef struct
+{
+    /** The number of tasks that failed. */
+    size_t count;
+    /** The exceptions of the first LIBEXCEPT_AGGREGATE_ERRORS tasks that failed, in order. */
+    libexcept_captured_t* errors[LIBEXCEPT_AGGREGATE_ERRORS];
+} aggregate_error_t;
+
+typedef struct libexcept_task_group libexcept_task_group_t;
+
+/**
+ * Creates a task group. Tasks spawned from within one of its tasks are cancelled along with it.
+ *
+ * @param failure What to throw when tasks fail.
+ * @return The group or NULL if out of memory.
+ */
+libexcept_task_group_t* libexcept_create_task_group(libexcept_failure_t failure);
+
+/**
+ * Runs task(index, argument) on the pool. Tasks may spawn more tasks into their own group. If
+ * there is no memory to queue the task, it is run right away in the calling thread instead.
+ *
+ * @param group The group of the task, which has not been waited for.
+ * @param task The task.
+ * @param index Passed to the task.
+ * @param argument Passed to the task.
+ */
+void libexcept_spawn(libexcept_task_group_t* group, libexcept_task_t task, size_t index,
+                     void* argument);
+
+/**
+ * Waits for every task of a group to return and destroys the group. This must be called for every
+ * group, even if it has no tasks, and not from one of its own tasks.
+ *
+ * @param group The group.
+ */
+void libexcept_wait_task_group(libexcept_task_group_t* group);
+
+/**
+ * Runs task(index, argument) for every index from 0 to count - 1 in parallel and waits for all of
+ * them to return. Loops may be nested.
+ *
+ * @param count The number of indices.
+ * @param task The task.
+ * @param argument Passed to every task.
+ * @param threads The maximum number of threads to use, including the calling one, or 0 to use one
+ * for every processor. The pool grows to provide them.
+ * @param failure What to throw when tasks fail.
+ */
+void libexcept_parallel_for(size_t count, libexcept_task_t task, void* argument, unsigned threads,
+                            libexcept_failure_t failure);
+
+/**
+ * Checks whether the group running the calling task, or any group it is nested in, has been
+ * cancelled because a task failed.
+ *
+ * @return Non-zero if the calling task should return, 0 otherwise or when not called from a task.
+ */
+int libexcept_cancelled();
+
+/**
+ * Releases the exceptions held by an aggregate_error_t.
+ *
+ * @param error The error.
+ */
+void libexcept_release_aggregate(const aggregate_error_t* error);
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_THROW_IN
+/**
+ * @defgroup throw_in Throwing into other threads.
+ *
+ * A thread can throw an exception into another one, for example to cancel work that is no longer
+ * needed. The exception is not thrown right away but at the next safe point of the other thread,
+ * which is either the start of a try block or a call to libexcept_check(). Checking costs a single
+ * relaxed load of a flag of the calling thread, so it can be done in tight loops, and nothing is
+ * shared between the threads until an exception is actually thrown. At the start of a try block
+ * the exception is thrown before the block is entered, so it is handled by the try blocks around
+ * it and not by the catch clauses of the block itself.
+ *
+ * @code
+ * // In the worker.
+ * try
+ * {
+ *     for (size_t i = 0; i < count; i++)
+ *     {
+ *         libexcept_check();
+ *         process(items[i]);
+ *     }
+ * }
+ * catch (cancelled_t, cancelled) { ... }
+ *
+ * // In another thread.
+ * libexcept_throw_in(worker, cancelled_t, {.reason = SHUTDOWN});
+ * @endcode
+ *
+ * A thread can only be thrown into once it has reached its first safe point. As with any other
+ * exception, one thrown at a safe point within a catch or finally clause must not leave the clause.
+ *
+ * @{
+ */
+
+/**
+ * Throws an exception into a thread at its next safe point. The object is copied, so it may be
+ * initialized from temporaries.
+ *
+ * @param thread The thread to throw into, which may be the calling thread.
+ * @param T The type of the exception.
+ * @param ... The initializer of the thrown object, as for throw.
+ * @return 1 if the exception will be thrown into the thread, 0 if the thread has not reached a safe
+ * point yet, has exited or already has an exception pending, or if out of memory.
+ */
+#define libexcept_throw_in(thread, T, ...)                                                         \
+    __libexcept_throw_in((thread), LIBEXCEPT_TYPE(T), sizeof(T),                                   \
+                         (T[1]){__VA_ARGS__}, __LIBEXCEPT_SITE_EXPRESSION(T))
+
+/**
+ * Throws the exception thrown into the calling thread, if there is one. With LIBEXCEPT_DEADLINES it
+ * also throws a deadline_exceeded_t if a deadline of the calling thread has expired.
+ */
+#define libexcept_check() ((void)__LIBEXCEPT_POLL())
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_FIBERS
+/**
+ * @defgroup fibers Fibers.
+ *
+ * Try blocks, thrown objects and the current exception belong to the thread that runs them. Code
+ * that switches between stacks on the same thread, such as a scheduler of green threads built on
+ * swapcontext, has to switch this exception state along with the stack. Otherwise a fiber that
+ * yields inside a try block corrupts the try blocks of the next one.
+ *
+ * Each fiber gets its own state from libexcept_create_fiber, which the scheduler sets on the thread
+ * whenever it switches to the fiber. Switching is a single pointer store. A fiber may be resumed
+ * on a different thread than the one it was suspended on.
+ *
+ * @code
+ * void switch_to(struct fiber* from, struct fiber* to)
+ * {
+ *     libexcept_set_fiber(to->exceptions);
+ *     swapcontext(&from->context, &to->context);
+ * }
+ * @endcode
+ *
+ * @{
+ */
+
+typedef struct libexcept_fiber libexcept_fiber_t;
+
+/**
+ * Creates the exception state of a fiber, which has no try blocks or exceptions yet.
+ *
+ * @return The state or NULL if out of memory.
+ */
+libexcept_fiber_t* libexcept_create_fiber();
+
+/**
+ * Destroys the exception state of a fiber, which may not be set on any thread.
+ *
+ * @param fiber The state or NULL.
+ */
+void libexcept_destroy_fiber(libexcept_fiber_t* fiber);
+
+/**
+ * Gets the exception state set on the calling thread.
+ *
+ * @return The state or NULL if the thread uses its own.
+ */
+libexcept_fiber_t* libexcept_get_fiber();
+
+/**
+ * Sets the exception state used by the calling thread from now on.
+ *
+ * @param fiber The state or NULL for the state of the thread itself.
+ */
+void libexcept_set_fiber(libexcept_fiber_t* fiber);
+
+/**
+ * Sets the exception state used by the calling thread and returns the previous one.
+ *
+ * @param fiber The state or NULL for the state of the thread itself.
+ * @return The previous state or NULL if the thread was using its own.
+ */
+libexcept_fiber_t* libexcept_swap_fiber(libexcept_fiber_t* fiber);
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_REGIONS
+/**
+ * @defgroup regions Regions.
+ *
+ * Every try block has a region of memory which is released when the block exits, whether normally
+ * or because of an exception. Allocating from it is a pointer increment and releasing it frees
+ * everything allocated at once, so short-lived buffers need neither a free nor a finally clause.
+ * The region of a try block is still available in its catch and finally clauses.
+ *
+ * @code
+ * try
+ * {
+ *     char* line = libexcept_region_alloc(length + 1);
+ *     parse(line);
+ * }
+ * catch (parse_error_t, error) { ... }
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * Allocates memory from the region of the innermost try block. The memory is suitably aligned for
+ * any type and is released when that try block exits.
+ *
+ * @param size The size of the memory.
+ * @return The memory or NULL if not within a try block or out of memory.
+ */
+void* libexcept_region_alloc(size_t size);
+
+/**
+ * Copies an allocation to the region of the try block that immediately encloses the innermost one,
+ * creating that region if the block has not allocated from it yet. The copy is released when that
+ * try block exits.
+ *
+ * @param pointer The allocation.
+ * @param size The size of the allocation.
+ * @return The copy or NULL if there is no enclosing try block or out of memory.
+ */
+void* libexcept_region_promote(const void* pointer, size_t size);
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+/**
+ * @defgroup deadlines Deadlines.
+ *
+ * A try_deadline block bounds the time spent in it. Each thread has a timer which is armed when
+ * the block is entered and disarmed when it is done with its body. If it expires first, the signal
+ * it sends marks the deadline as expired and makes a blocking system call of the thread fail with
+ * EINTR. A deadline_exceeded_t is then thrown at the next safe point of the thread, which is either
+ * the start of a try block or a call to libexcept_check(), and the catch clauses of the block can
+ * handle it like any other exception. The timer uses the first real-time signal (SIGRTMIN) and is
+ * created the first time a thread enters such a block. If that fails, the errno value is thrown as
+ * an int before the block is entered.
+ *
+ * Nested blocks collapse to the earliest deadline, so entering a block whose deadline is later
+ * than the one already in effect only reads the clock. A deadline only fires once. If its
+ * exception is caught within the block it belongs to, the rest of that block is not interrupted
+ * again, but blocks entered after it expired are.
+ *
+ * Code guarded by a deadline has to reach safe points regularly, for example by checking in its
+ * loops, and to retry or give up on system calls that fail with EINTR. The catch and finally
+ * clauses of a block run without its deadline, and the deadline of the block around it is only
+ * restored once they are done.
+ *
+ * @code
+ * try_deadline (50 * 1000 * 1000)
+ * {
+ *     for (size_t i = 0; i < count; i++)
+ *     {
+ *         libexcept_check();
+ *         inflate_block(&stream, i);
+ *     }
+ * }
+ * catch (deadline_exceeded_t, error) { ... }
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * Thrown into a try_deadline block that is still running once its deadline expires.
+ */
+typedef struct
+{
+    const char* message;
+    /** The expired deadline on the CLOCK_MONOTONIC clock, in nanoseconds. */
+    uint64_t deadline;
+} deadline_exceeded_t;
+
+#ifndef LIBEXCEPT_THROW_IN
+/**
+ * Throws a deadline_exceeded_t if a deadline of the calling thread has expired.
+ */
+#define libexcept_check() ((void)__LIBEXCEPT_POLL())
+#endif
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_STATISTICS
+/**
+ * @defgroup statistics Statistics.
+ *
+ * Each thread counts the exceptions it throws, catches and propagates, both in total and per type,
+ * along with the deepest nesting of try blocks it has entered. The counters are only ever written
+ * by their own thread, so keeping them costs no synchronization. libexcept_get_statistics sums
+ * them up over all threads, including those that have already exited.
+ *
+ * @code
+ *
+ * libexcept_statistics_t statistics;
+ * libexcept_get_statistics(&statistics);
+ *
+ * for (int i = 0; i < LIBEXCEPT_STATISTICS_TYPES && statistics.types[i].type != NULL; i++)
+ * {
+ *     printf("%s: %llu\n", statistics.types[i].type->name, statistics.types[i].throws);
+ * }
+ *
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * The number of distinct exception types counted separately. Exceptions of any further types are
+ * only included in the untracked counters.
+ */
+#define LIBEXCEPT_STATISTICS_TYPES 32
+
+/**
+ * Counters for a single exception type.
+ */
+typedef struct
+{
+    const struct libexcept_type* type;
+    unsigned long long throws;
+    unsigned long long catches;
+} libexcept_type_statistics_t;
+
+/**
+ * A snapshot of the exception statistics.
+ */
+typedef struct
+{
+    /** Exceptions thrown with throw or throw_new, including those thrown for signals. */
+    unsigned long long throws;
+    /** Exceptions handled by a catch or catch_any clause. */
+    unsigned long long catches;
+    /** Exceptions propagated out of a try block, either by rethrow or by not being caught. */
+    unsigned long long rethrows;
+    /** Exceptions never caught. */
+    unsigned long long unhandled;
+    /** Exceptions thrown from catch or finally clauses or from event hooks. */
+    unsigned long long unexpected;
+    /** The deepest nesting of try blocks entered by any thread. */
+    int max_try_depth;
+    /** Counters per type, in no particular order. Unused entries have a NULL type. */
+    libexcept_type_statistics_t types[LIBEXCEPT_STATISTICS_TYPES];
+    /** Counters for the types that did not fit in types. Its type is always NULL. */
+    libexcept_type_statistics_t untracked;
+} libexcept_statistics_t;
+
+/**
+ * Takes a snapshot of the statistics of all threads. Counters of threads that are running at the
+ * same time may be slightly out of date.
+ *
+ * @param statistics Where to store the snapshot.
+ */
+void libexcept_get_statistics(libexcept_statistics_t* statistics);
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_BACKTRACE
+/**
+ * @defgroup backtraces Backtraces.
+ *
+ * Thrown exceptions carry the return addresses of the stack frames that led to the throw. Only the
+ * raw addresses are captured, since resolving them to symbols is much more expensive. That is done
+ * by libexcept_symbolize when a backtrace is printed and its results are cached, so addresses that
+ * have been seen before cost a lookup. The default unhandled and unexpected handlers print the
+ * backtrace of the exception.
+ *
+ * Capturing can be limited to every n-th throw of each type with libexcept_backtrace_sampling. A
+ * rethrown exception keeps the backtrace of the original throw.
+ *
+ * Symbol names of functions in the executable itself are only available if it is linked with
+ * -rdynamic.
+ *
+ * @code
+ *
+ * try { ... }
+ * catch (int, error)
+ * {
+ *     void* const* frames;
+ *     size_t count = libexcept_exception_backtrace(&frames);
+ *     for (size_t i = 0; i < count; i++)
+ *     {
+ *         puts(libexcept_symbolize(frames[i]));
+ *     }
+ * }
+ *
+ * @endcode
+ *
+ * @{
+ */
+
+/**
+ * The maximum number of frames captured for each exception.
+ */
+#define LIBEXCEPT_BACKTRACE_DEPTH 32
+
+/**
+ * A backtrace is captured for one in every libexcept_backtrace_sampling throws of each type, on
+ * each thread. The default of 1 captures every throw and 0 disables capturing. Like the event hooks
+ * this is not thread-safe to change and is intended to be set just after entering main.
+ */
+extern unsigned libexcept_backtrace_sampling;
+
+/**
+ * Returns the backtrace of the exception currently being thrown or handled, starting from the
+ * function that threw it. The frames remain valid until the exception is handled.
+ *
+ * @param frames Set to the return addresses of the frames.
+ * @return The number of frames or 0 if no backtrace was captured.
+ */
+size_t libexcept_exception_backtrace(void* const** frames);
+
+/**
+ * Resolves an address to a human readable description, including the symbol and module that it
+ * belongs to if these are known. Results are cached and remain valid for the rest of the program.
+ *
+ * @param address The address to resolve.
+ * @return The description of address or NULL if it could not be resolved.
+ */
+const char* libexcept_symbolize(void* address);
+
+/**
+ * @}
+ */
+#endif
+
+#ifdef LIBEXCEPT_RECORDER
+/**
+ * @defgroup recorder Flight recorder.
+ *
+ * The flight recorder keeps the most recent exceptions thrown by each thread in a memory-mapped
+ * file, so that they can still be inspected after the process has crashed or been killed. Each
+ * entry holds the time, thread, type, throw site and the first bytes of the thrown object.
+ * Recording an exception only consists of stores to the mapping.
+ *
+ * Each thread claims one of the rings of the file the first time it throws and releases it when it
+ * exits, after which the ring is reused by other threads. Threads that find no free ring are not
+ * recorded. The except_decode tool prints the contents of a recorder file. Its layout is described
+ * in except_recorder.h.
+ *
+ * @{
+ */
+
+/**
+ * Starts recording thrown exceptions to a file, which is created or truncated. This should be
+ * called just after entering main. Once it succeeded, the recorder can not be restarted and later
+ * calls fail with EBUSY.
+ *
+ * @param path The path of the file.
+ * @param rings The number of rings, which limits the number of threads recorded at the same time.
+ * @return 0 on success or -1 on failure, in which case errno is set.
+ */
+int libexcept_start_recorder(const char* path, int rings);
+
+/**
+ * @}
+ */
+#endif
+
+/**
+ * Thrown whenever an arithmetic related error (such as division by zero) occurs. This error
+ * directly coresponds to SIGFPE when catching signals. It is also thrown by checked_fp blocks, in
+ * which case pc is the address just after the block. Although these errors are probably due to
+ * buggy code, they are most likely not fatal and safe to catch.
+ */
+typedef struct
+{
+    const char* message;
+    void* pc;
+} arithmetic_error_t;
+
+#ifdef LIBEXCEPT_SIGNAL_AWARE
+/**
+ * Enables transforming of signals to exceptions.
+ *
+ * With LIBEXCEPT_SIGNAL_STACKS, signals are handled on an alternate stack, which the calling thread
+ * gets right away and every other thread at its next try block. These stacks are taken from a pool
+ * and given back when their thread exits. The exception of a signal is thrown on that stack, which
+ * holds 64 KiB besides the signal frame, so the hooks it runs (see libexcept_subscribe) must stay
+ * well within that. Overflowing it kills the process.
+ *
+ * With LIBEXCEPT_UNWIND, the exception of a signal only reaches the try blocks around code that the
+ * compiler considers able to throw. Calls to functions declared nothrow, such as most of the C
+ * library, and code that only accesses its own locals get no landing pad.
+ */
+void libexcept_enable_sigcatch();
+
+/**
+ * Disables transforming of signals to exceptions. Threads keep their alternate signal stacks.
+ */
+void libexcept_disable_sigcatch();
+
+/**
+ * Thrown whenever an illegal, privileged or malformed instruction is executed. This error directly
+ * coresponds to SIGILL. These errors should never happen under normal circumstances and their
+ * occurrence is usually fatal. It is not advised to handle these sorts of errors.
+ */
+typedef struct
+{
+    const char* message;
+    void* pc;
+} illegal_instruction_error_t;
+
+/**
+ * Thrown whenever the stack is corrupted (for example on stack overflow). This error roughly
+ * coresponds to SIGILL. This error is fatal, except for stack overflows caught with
+ * LIBEXCEPT_SIGNAL_STACKS. These are SIGSEGVs in the guard area of the stack of a thread and can be
+ * handled by a try block further up the stack, which is left intact.
+ */
+typedef struct
+{
+    const char* message;
+    void* pc;
+} stack_corruption_error_t;
+
+/**
+ * Base of the errors caused by invalid memory accesses. Catching this catches access_violation_t,
+ * misaligned_access_error_t and mapped_io_error_t.
+ */
+typedef struct
+{
+    const char* message;
+    void* address;
+} memory_error_t;
+
+/**
+ * Thrown whenever a program tries to access memory which it does not have ownership of. This error
+ * coresponds to SIGSEGV and some instances of SIGBUS. This error usually means an invalid or NULL
+ * pointer was dereferenced. This is the cause of a serious program bug and should not be handled.
+ */
+typedef struct
+{
+    const char* message;
+    void* address;
+} access_violation_t;
+
+/**
+ * This is thrown on some occasions when a program dereferences a pointer not properly aligned for
+ * the data type it points to. Sometimes this may manifest itself as an access_violation_t. It
+ * corresponds to some instances of SIGBUS. As with access_violation_t it is a result of buggy code
+ * and should not be handled.
+ */
+typedef struct
+{
+    const char* message;
+    void* address;
+} misaligned_access_error_t;
+
+/**
+ * Thrown whenever a memory-mapped region of a file registered with libexcept_register_mapping can
+ * not be accessed, which is reported as SIGBUS. This happens when the file was truncated after it
+ * was mapped or when reading it failed. Unlike the other memory errors this is not a bug and is
+ * safe to handle, so parsers can read a mapped file directly and handle it once around a scan.
+ */
+typedef struct
+{
+    const char* message;
+    void* address;
+    dev_t device;
+    ino_t inode;
+    off_t offset;
+} mapped_io_error_t;
+
+/**
+ * The number of memory-mapped regions that can be registered at the same time.
+ */
+#define LIBEXCEPT_MAX_MAPPINGS 64
+
+/**
+ * Registers a memory-mapped region of a file, so that faults on it throw a mapped_io_error_t with
+ * the identity of the file and the offset within it. The registry is shared by all threads and is
+ * searched only when a SIGBUS is caught.
+ *
+ * @code
+ * char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+ * libexcept_register_mapping(data, size, fd, 0);
+ *
+ * try
+ * {
+ *     parse(data, size);
+ * }
+ * catch (mapped_io_error_t, error)
+ * {
+ *     fprintf(stderr, "%s: offset %lld\n", error.message, (long long)error.offset);
+ * }
+ *
+ * libexcept_unregister_mapping(data);
+ * munmap(data, size);
+ * @endcode
+ *
+ * @param base The start of the region.
+ * @param length The length of the region in bytes.
+ * @param fd A descriptor of the mapped file, which may be closed afterwards.
+ * @param offset The offset in the file at which the region starts.
+ * @return 1 on success, 0 if the file could not be identified or LIBEXCEPT_MAX_MAPPINGS regions are
+ * already registered.
+ */
+int libexcept_register_mapping(const void* base, size_t length, int fd, off_t offset);
+
+/**
+ * Unregisters a region registered with libexcept_register_mapping. This must be done before the
+ * region is unmapped.
+ *
+ * @param base The start of the region.
+ */
+void libexcept_unregister_mapping(const void* base);
+
+#endif
+
+/*
+  End of public API.
+ */
+
+/*
+  The signal mask is never saved on try entry since that costs a system call. Instead the signal
+  handler restores the mask that was active when the signal was delivered before throwing.
+
+  The lightweight context only consists of the frame pointer, the resume address and the stack
+  pointer (plus two words of scratch space on some targets). Since the compiler knows about these
+  builtins, it spills whatever else is live across them instead of relying on the buffer.
+
+  A full jmp_buf only restores the callee-saved registers as they were at the setjmp, so the locals
+  of a try block that change after it, such as its stage, are declared __LIBEXCEPT_CLOBBERABLE to
+  keep them in memory. The variable of a catch clause can not be volatile since user code may take
+  its address, so it is spilled with __LIBEXCEPT_SPILL instead. Nothing reads it after a jump back
+  into the block, which only happens once its catch clause has thrown and is never resumed.
+ */
+#if defined(LIBEXCEPT_LIGHTWEIGHT_CONTEXT) || defined(LIBEXCEPT_UNWIND)
+typedef void* __libexcept_context_t[5];
+#define __LIBEXCEPT_JMP_BUF               __libexcept_context_t
+#define __LIBEXCEPT_SETJMP(buffer)        __builtin_setjmp(buffer)
+#define __LIBEXCEPT_LONGJMP(buffer, code) __builtin_longjmp(buffer, 1)
+#define __LIBEXCEPT_CLOBBERABLE
+#elif defined(LIBEXCEPT_SIGNAL_AWARE)
+#define __LIBEXCEPT_JMP_BUF        sigjmp_buf
+#define __LIBEXCEPT_SETJMP(buffer) sigsetjmp(buffer, 0)
+#define __LIBEXCEPT_LONGJMP        siglongjmp
+#define __LIBEXCEPT_CLOBBERABLE    volatile
+#else
+#define __LIBEXCEPT_JMP_BUF        jmp_buf
+#define __LIBEXCEPT_SETJMP(buffer) setjmp(buffer)
+#define __LIBEXCEPT_LONGJMP        longjmp
+#define __LIBEXCEPT_CLOBBERABLE    volatile
+#endif
+
+#if defined(__GNUC__) && !defined(LIBEXCEPT_LIGHTWEIGHT_CONTEXT) && !defined(LIBEXCEPT_UNWIND)
+#define __LIBEXCEPT_SPILL(var) ({ __asm__("" : : "r"(&(var)) : "memory"); })
+#else
+#define __LIBEXCEPT_SPILL(var) ((void)0)
+#endif
+
+#ifdef __GNUC__
+#define __LIBEXCEPT_UNUSED __attribute__((unused))
+#else
+#define __LIBEXCEPT_UNUSED
+#endif
+
+#define __LIBEXCEPT_STAGE_TRY        0
+#define __LIBEXCEPT_STAGE_CATCH      1
+#define __LIBEXCEPT_STAGE_FINALLY    2
+#define __LIBEXCEPT_STAGE_PROPAGATE  3
+#define __LIBEXCEPT_STAGE_UNEXPECTED -1
+#define __LIBEXCEPT_UNIQUE(var)      __LIBEXCEPT_CONCAT(__libexcept_##var, __LINE__)
+#define __LIBEXCEPT_CONCAT(a, b)     __LIBEXCEPT_CONCAT_(a, b)
+#define __LIBEXCEPT_CONCAT_(a, b)    a##b
+#define __LIBEXCEPT_THROW(T, ...)                                                                  \
+    do                                                                                             \
+    {                                                                                              \
+        static const libexcept_site_t __libexcept_site = __LIBEXCEPT_SITE(T);                      \
+        *(T*)__libexcept_allocate(LIBEXCEPT_TYPE(T), sizeof(T)) =                                  \
+            (T[1]){__VA_ARGS__}[0];                                                \
+        __libexcept_throw(&__libexcept_site);                                                      \
+    } while (0)
+#define __LIBEXCEPT_THROW_NEW(T, var)                                                              \
+    for (T* var = (T*)__libexcept_allocate(LIBEXCEPT_TYPE(T), sizeof(T));;                         \
+         __libexcept_throw(__LIBEXCEPT_SITE_EXPRESSION(T)))
+#define __LIBEXCEPT_THROW_MESSAGE(T, ...)                                                          \
+    do                                                                                             \
+    {                                                                                              \
+        static const libexcept_site_t __libexcept_site = __LIBEXCEPT_SITE(T);                      \
+        T* __libexcept_exception = (T*)__libexcept_allocate(LIBEXCEPT_TYPE(T), sizeof(T));         \
+        *__libexcept_exception = (T){0};                                              \
+        __libexcept_throw_message(&__libexcept_site, &__libexcept_exception->message,              \
+                                  __VA_ARGS__);                                                    \
+    } while (0)
+#define __LIBEXCEPT_RETHROW() break
+#define __LIBEXCEPT_CHECKED_FP                                                                     \
+    for (fenv_t __libexcept_env, *__libexcept_held = __libexcept_hold_fp(&__libexcept_env);        \
+         __libexcept_held != NULL;                                                                 \
+         __libexcept_held = __libexcept_check_fp(__libexcept_held, LIBEXCEPT_FP_EXCEPTIONS,        \
+                                                 __LIBEXCEPT_SITE_EXPRESSION(arithmetic_error_t)))
+
+#define __LIBEXCEPT_SITE(T)                                                                        \
+    {                                                                                              \
+        LIBEXCEPT_TYPE(T), __FILE__, __LINE__, __func__, LIBEXCEPT_THROW_SEVERITY                  \
+    }
+
+/*
+  throw_new can not declare its site as a separate statement, so it has to be done within an
+  expression.
+ */
+#ifdef __GNUC__
+#define __LIBEXCEPT_SITE_EXPRESSION(T)                                                             \
+    ({                                                                                             \
+        static const libexcept_site_t __libexcept_site = __LIBEXCEPT_SITE(T);                      \
+        &__libexcept_site;                                                                         \
+    })
+#else
+#define __LIBEXCEPT_SITE_EXPRESSION(T) NULL
+#endif
+
+#define __LIBEXCEPT_TYPE_DESCRIPTOR(T) __libexcept_type_##T
+#define __LIBEXCEPT_TYPE_DEPTH(T)      __libexcept_type_depth_##T
+
+#define __LIBEXCEPT_SUBTYPE_DEPTH(T, Base)                                                         \
+    enum                                                                                           \
+    {                                                                                              \
+        __LIBEXCEPT_TYPE_DEPTH(T) = __LIBEXCEPT_TYPE_DEPTH(Base) + 1                               \
+    };                                                                                             \
+    static_assert(__LIBEXCEPT_TYPE_DEPTH(T) < LIBEXCEPT_MAX_TYPE_DEPTH,                            \
+                  "Type hierarchy exceeds the maximum depth supported by libexcept")
+
+#define __LIBEXCEPT_DECLARE_DESCRIPTOR(T)                                                          \
+    extern const libexcept_type_t __LIBEXCEPT_TYPE_DESCRIPTOR(T)
+#define __LIBEXCEPT_DEFINE_DESCRIPTOR(T)                                                           \
+    const libexcept_type_t __LIBEXCEPT_TYPE_DESCRIPTOR(T)
+
+/*
+  Names that start with a keyword, such as unsigned long, can not be pasted into the name of a
+  descriptor. Whether T starts with one is found by pasting its first token onto a prefix, which
+  only expands to something for keywords. The built-in types are then looked up by type instead,
+  while struct, union and enum types fail to link with a descriptive symbol.
+ */
+#define __LIBEXCEPT_KEYWORD_signed   ~, 1,
+#define __LIBEXCEPT_KEYWORD_unsigned ~, 1,
+#define __LIBEXCEPT_KEYWORD_short    ~, 1,
+#define __LIBEXCEPT_KEYWORD_long     ~, 1,
+#define __LIBEXCEPT_KEYWORD_struct   ~, 1,
+#define __LIBEXCEPT_KEYWORD_union    ~, 1,
+#define __LIBEXCEPT_KEYWORD_enum     ~, 1,
+
+#define __LIBEXCEPT_SECOND(first, second, ...) second
+#define __LIBEXCEPT_IS_KEYWORD(...)            __LIBEXCEPT_SECOND(__VA_ARGS__, 0, )
+#define __LIBEXCEPT_TYPE_BY(keyword, T)        __LIBEXCEPT_CONCAT(__LIBEXCEPT_TYPE_BY_, keyword)(T)
+#define __LIBEXCEPT_TYPE_BY_0(T)               (&__LIBEXCEPT_TYPE_DESCRIPTOR(T))
+#define __LIBEXCEPT_TYPE_BY_1(T)               __LIBEXCEPT_BUILTIN_TYPE(T)
+
+#define __LIBEXCEPT_BUILTIN_TYPES(X)                                                               \
+    X(char, char)                                                                                  \
+    X(signed char, signed_char)                                                                    \
+    X(unsigned char, unsigned_char)                                                                \
+    X(short, short)                                                                                \
+    X(unsigned short, unsigned_short)                                                              \
+    X(int, int)                                                                                    \
+    X(unsigned, unsigned)                                                                          \
+    X(long, long)                                                                                  \
+    X(unsigned long, unsigned_long)                                                                \
+    X(long long, long_long)                                                                        \
+    X(unsigned long long, unsigned_long_long)                                                      \
+    X(float, float)                                                                                \
+    X(double, double)                                                                              \
+    X(long double, long_double)
+
+#define __LIBEXCEPT_BUILTIN_CASE(type, id) type* : &__LIBEXCEPT_TYPE_DESCRIPTOR(id),
+#define __LIBEXCEPT_BUILTIN_TYPE(T)                                                                \
+    _Generic((T*)0,                                                                                \
+             __LIBEXCEPT_BUILTIN_TYPES(__LIBEXCEPT_BUILTIN_CASE)                                   \
+             default: &__libexcept_type_needs_a_typedef_name)
+
+#ifdef __GNUC__
+#define __LIBEXCEPT_PRINTF(string, first) __attribute__((format(printf, string, first)))
+#else
+#define __LIBEXCEPT_PRINTF(string, first)
+#endif
+
+#ifdef LIBEXCEPT_UNWIND
+/*
+  Try blocks are not linked together. Instead each one owns a guard variable with a cleanup, which
+  gives it a landing pad that the platform unwinder runs while unwinding the frame. The guard jumps
+  back into the try block unless it was disarmed by leaving it normally.
+
+  This is not a table-driven zero-cost implementation. A personality routine is chosen by the
+  compiler for each function, and for C that is always the one of GCC, which only runs cleanups. So
+  every try block still does a __builtin_setjmp, a throw is a forced unwind that stops at each try
+  block on the way to run its clauses and resume, and an exception that nothing catches is only
+  detected once the whole stack has been unwound.
+ */
+#define __LIBEXCEPT_TRY_BLOCK(leave, exit)                                                         \
+    __LIBEXCEPT_JMP_BUF __LIBEXCEPT_UNIQUE(local_buffer);                                          \
+    __LIBEXCEPT_ENTER();                                                                           \
+    for (void** volatile __LIBEXCEPT_UNIQUE(guard) __attribute__((cleanup(__libexcept_leave))) =   \
+             __LIBEXCEPT_UNIQUE(local_buffer);                                                     \
+         __LIBEXCEPT_UNIQUE(guard) != NULL;                                                        \
+         __LIBEXCEPT_UNIQUE(guard) = NULL)                                                         \
+        for (int __libexcept_stage = 0,                                                            \
+                 __libexcept_error = __LIBEXCEPT_SETJMP(__LIBEXCEPT_UNIQUE(local_buffer));         \
+             __libexcept_stage < 4;                                                                \
+             __libexcept_stage++)                                                                  \
+            if (__libexcept_stage == __LIBEXCEPT_STAGE_PROPAGATE)                                  \
+            {                                                                                      \
+                __LIBEXCEPT_UNIQUE(guard) = NULL;                                                  \
+                __LIBEXCEPT_LEAVE();                                                               \
+                (void)(exit);                                                                      \
+                if (__libexcept_error != 0)                                                        \
+                {                                                                                  \
+                    __libexcept_rethrow();                                                         \
+                }                                                                                  \
+            }                                                                                      \
+            else if (__libexcept_stage == __LIBEXCEPT_STAGE_UNEXPECTED)                            \
+            {                                                                                      \
+                __libexcept_unexpected();                                                          \
+            }                                                                                      \
+            else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && (leave))                      \
+            {                                                                                      \
+            }                                                                                      \
+            else if (__libexcept_stage == __LIBEXCEPT_STAGE_TRY && __libexcept_error == 0)
+#else
+#define __LIBEXCEPT_TRY_BLOCK(leave, exit)                                                         \
+    __libexcept_frame __LIBEXCEPT_UNIQUE(frame);                                                   \
+    __LIBEXCEPT_UNIQUE(frame).previous = *__libexcept_current_context();                           \
+    *__libexcept_current_context() = &__LIBEXCEPT_UNIQUE(frame).buffer;                            \
+    __LIBEXCEPT_ENTER();                                                                           \
+    for (__LIBEXCEPT_CLOBBERABLE int __libexcept_stage = 0,                                        \
+             __libexcept_error = __LIBEXCEPT_SETJMP(__LIBEXCEPT_UNIQUE(frame).buffer);             \
+         __libexcept_stage < 4;                                                                    \
+         __libexcept_stage++)                                                                      \
+        if (__libexcept_stage == __LIBEXCEPT_STAGE_PROPAGATE)                                      \
+        {                                                                                          \
+            *__libexcept_current_context() = __LIBEXCEPT_UNIQUE(frame).previous;                   \
+            __LIBEXCEPT_LEAVE_REGION(&__LIBEXCEPT_UNIQUE(frame).buffer);                           \
+            __LIBEXCEPT_LEAVE();                                                                   \
+            (void)(exit);                                                                          \
+            if (__libexcept_error != 0)                                                            \
+            {                                                                                      \
+                __libexcept_rethrow();                                                             \
+            }                                                                                      \
+        }                                                                                          \
+        else if (__libexcept_stage == __LIBEXCEPT_STAGE_UNEXPECTED)                                \
+        {                                                                                          \
+            __libexcept_unexpected();                                                              \
+        }                                                                                          \
+        else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && (leave))                          \
+        {                                                                                          \
+        }                                                                                          \
+        else if (__libexcept_stage == __LIBEXCEPT_STAGE_TRY && __libexcept_error == 0)
+#endif
+
+/*
+  leave is evaluated right after the body of a try block, whether it completed or threw, and must
+  evaluate to 0. exit is evaluated once the block has run its clauses, before an exception
+  propagates out of it. A try block polls before it is entered, so that an exception thrown into
+  the thread goes to the try blocks around it. The try blocks of libexcept itself do not poll, since
+  they are not expected to throw.
+ */
+#define __LIBEXCEPT_TRY                                                                            \
+    (void)__LIBEXCEPT_POLL();                                                                      \
+    __LIBEXCEPT_TRY_BLOCK(0, 0)
+
+#ifdef LIBEXCEPT_DEADLINES
+/*
+  The deadline is only in effect for the body of the block. It is disarmed before the catch and
+  finally clauses run and the one around the block is only restored once they are done, so that
+  neither expires into them. The thread polls and arms its timer before the block is entered, so
+  that an exception thrown by either goes to the try blocks around it rather than to this one.
+ */
+#define __LIBEXCEPT_TRY_DEADLINE(nanoseconds)                                                      \
+    uint64_t __LIBEXCEPT_UNIQUE(deadline) = __libexcept_thread.deadline;                           \
+    __libexcept_enter_deadline(nanoseconds);                                                       \
+    __LIBEXCEPT_TRY_BLOCK(__libexcept_suspend_deadline(__LIBEXCEPT_UNIQUE(deadline)),              \
+                          __libexcept_restore_deadline(__LIBEXCEPT_UNIQUE(deadline)))
+#endif
+
+#define __LIBEXCEPT_CATCH(T, var)                                                                  \
+    else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && __libexcept_error != 0 &&             \
+             __libexcept_personality(LIBEXCEPT_TYPE(T)))                                           \
+        __LIBEXCEPT_UNEXPECTED_LOOP(                                                               \
+            __LIBEXCEPT_STAGE_CATCH) for (T var __LIBEXCEPT_UNUSED =                               \
+                                              *(T*)__libexcept_current_exception();                \
+                                          __LIBEXCEPT_SPILL(var), __libexcept_error != 0;          \
+                                          __libexcept_error = __libexcept_handled())
+
+#define __LIBEXCEPT_CATCH_REF(T, var)                                                              \
+    else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && __libexcept_error != 0 &&             \
+             __libexcept_personality(LIBEXCEPT_TYPE(T)))                                           \
+        __LIBEXCEPT_UNEXPECTED_LOOP(                                                               \
+            __LIBEXCEPT_STAGE_CATCH) for (T* var __LIBEXCEPT_UNUSED =                              \
+                                              (T*)__libexcept_current_exception();                 \
+                                          __libexcept_error != 0;                                  \
+                                          __libexcept_error = __libexcept_handled())
+
+#define __LIBEXCEPT_CATCH_ANY                                                                      \
+    else if (__libexcept_stage == __LIBEXCEPT_STAGE_CATCH && __libexcept_error != 0)               \
+        __LIBEXCEPT_UNEXPECTED_LOOP(__LIBEXCEPT_STAGE_CATCH) for (;                                \
+                                                                  __libexcept_error != 0;          \
+                                                                  __libexcept_error =              \
+                                                                      __libexcept_handled())
+
+#define __LIBEXCEPT_FINALLY                                                                        \
+    else if (__libexcept_stage == __LIBEXCEPT_STAGE_FINALLY)                                       \
+        __LIBEXCEPT_UNEXPECTED_LOOP(__LIBEXCEPT_STAGE_FINALLY)
+
+#define __LIBEXCEPT_UNEXPECTED_LOOP(stage)                                                         \
+    for (__libexcept_stage = __LIBEXCEPT_STAGE_UNEXPECTED; __libexcept_stage != stage;             \
+         __libexcept_stage = stage)
+
+#ifdef LIBEXCEPT_UNWIND
+/*
+  The call is a cleanup of the entry, which the platform unwinder runs like the landing pads of try
+  blocks.
+ */
+#define __LIBEXCEPT_DEFER(function, argument)                                                      \
+    for (__libexcept_deferred __LIBEXCEPT_UNIQUE(deferred)                                         \
+             __attribute__((cleanup(__libexcept_call_deferred))) = {(function), (argument)},       \
+             *__libexcept_pushed = &__LIBEXCEPT_UNIQUE(deferred);                                  \
+         __libexcept_pushed != NULL;                                                               \
+         __libexcept_pushed = NULL)
+#else
+#define __LIBEXCEPT_DEFER(function, argument)                                                      \
+    for (__libexcept_deferred __LIBEXCEPT_UNIQUE(deferred),                                        \
+         *__libexcept_pushed = __libexcept_defer(&__LIBEXCEPT_UNIQUE(deferred), (function),        \
+                                                 (argument));                                      \
+         __libexcept_pushed != NULL;                                                               \
+         __libexcept_pushed = __libexcept_undefer(__libexcept_pushed))
+#endif
+
+/*
+  Descriptors for the types provided by libexcept, which are defined in except.c.
+ */
+
+#define __LIBEXCEPT_DECLARE_BUILTIN(type, id) __LIBEXCEPT_DECLARE_DESCRIPTOR(id);
+__LIBEXCEPT_BUILTIN_TYPES(__LIBEXCEPT_DECLARE_BUILTIN)
+
+// Never defined, so that throwing or catching a struct, union or enum without a typedef name fails.
+__LIBEXCEPT_DECLARE_DESCRIPTOR(needs_a_typedef_name);
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+LIBEXCEPT_DECLARE_TYPE(aggregate_error_t);
+#endif
+
+LIBEXCEPT_DECLARE_TYPE(arithmetic_error_t);
+
+#ifdef LIBEXCEPT_SIGNAL_AWARE
+LIBEXCEPT_DECLARE_TYPE(illegal_instruction_error_t);
+LIBEXCEPT_DECLARE_TYPE(stack_corruption_error_t);
+LIBEXCEPT_DECLARE_TYPE(memory_error_t);
+LIBEXCEPT_DECLARE_SUBTYPE(access_violation_t, memory_error_t);
+LIBEXCEPT_DECLARE_SUBTYPE(misaligned_access_error_t, memory_error_t);
+LIBEXCEPT_DECLARE_SUBTYPE(mapped_io_error_t, memory_error_t);
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+LIBEXCEPT_DECLARE_TYPE(deadline_exceeded_t);
+#endif
+
+/*
+  Per-thread state. All of it lives in a single cache line aligned block so that the keywords reach
+  it with one thread-local access, using the TLS model in LIBEXCEPT_TLS_MODEL where available. Its
+  hot members come first. The block is several KiB with the arena buffer and the statistics tables,
+  which the initial-exec model takes from the static TLS reserved at startup. A library loaded with
+  dlopen may not find that much left, so shared builds use the global-dynamic model instead.
+
+  Thrown objects are stored in an arena which is used as a stack. Each object is preceded by a
+  record which links it to the exception that was being handled when it was thrown, so that once it
+  is handled itself the previous one becomes current again and everything allocated after it is
+  released at once. The arena starts out as the buffer at the end of the state block. When that is
+  exhausted additional chunks are allocated from the heap, which are freed again once the arena is
+  back to the initial buffer.
+
+  With the unwinder backend each record also holds the exception object handed to the unwinder, so
+  that handlers of other languages that catch it, such as catch (...) in C++, can tell which
+  exception they release.
+
+  display[n] is the ancestor of the current exception type at depth n, including the type itself.
+  It is filled whenever the current exception changes so that checking for a base type in a catch
+  clause is a single lookup.
+
+  The statistics counters are only written by their own thread but may be read by any other, which
+  is why they are atomic. Their updates are plain loads and stores and never read-modify-write
+  operations. The per-type counters form a hash table keyed by descriptor address.
+
+  Backtrace sampling counts throws per type in a similar table, with a last shared counter for the
+  types that do not fit. Captured frames are allocated from the arena right after the exception.
+
+  Region allocations are bumped from heap chunks of their own. A region is created by the first
+  allocation made while its try block is the innermost one, and its header is allocated right after
+  the position it started at, so that releasing it restores that position and frees any chunks
+  added since. Regions only ever belong to the innermost try block, since with setjmp/longjmp every
+  try block passes through its propagate stage on the way out, so it is enough to check the top
+  region there. Promoted blocks are allocated from the heap and freed along with the region of the
+  enclosing try block, which is found through the context that each try block keeps in its frame
+  next to its own. If that try block has no region yet, one is created for it. When the innermost
+  try block already has a region on top, the new region goes right below it and its header is
+  allocated from the heap instead, marked by allocated.
+
+  The calls of defer blocks form a stack of entries, each of which lives in the frame of its block.
+  An entry remembers the try block that was innermost when it was pushed, so a throw only has to
+  run the entries on top that belong to the try block it jumps to. With the unwinder backend the
+  entries are not linked, since each one is a cleanup of its own.
+
+  injection is 0 until the thread first polls for exceptions thrown into it from other threads, at
+  which point it is added to the list of threads that can be thrown into. An exception thrown into
+  the thread is stored in injected, after which injection is set to pending, which is what polls
+  check for.
+
+  reader_epoch is the epoch in which the thread started calling event hooks, or 0 if it is not
+  calling any. It is only written by its own thread and read by threads replacing the subscribers.
+
+  deadline is the earliest deadline of the try_deadline blocks the thread is in, or 0 if there are
+  none. The timer of the thread is armed for it whenever it is not 0. The signal handler of the
+  timer only sets deadline_expired, which polls check for like injection.
+
+  With LIBEXCEPT_FIBERS a fiber has a state block of its own, which is reached through
+  __LIBEXCEPT_TASK while the fiber is set on a thread. Only the members describing the exceptions of
+  the running code are used from it. The statistics counters, the recorder ring, the sampling
+  table, the reader epoch and the deadline always belong to the thread.
+ */
+
+#ifdef LIBEXCEPT_UNWIND
+#include <unwind.h>
+#endif
+
+#if defined(LIBEXCEPT_STATISTICS) || defined(LIBEXCEPT_SIGNAL_STACKS)
+#include <stdatomic.h>
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+#include <signal.h>
+#include <time.h>
+#endif
+
+#ifdef LIBEXCEPT_THROW_IN
+#include <stdatomic.h>
+#include <threads.h>
+#endif
+
+typedef struct __libexcept_chunk
+{
+    struct __libexcept_chunk* next;
+    max_align_t data[];
+} __libexcept_chunk;
+
+#ifdef LIBEXCEPT_SJLJ
+typedef struct
+{
+    __LIBEXCEPT_JMP_BUF buffer;
+    __LIBEXCEPT_JMP_BUF* previous;
+} __libexcept_frame;
+#endif
+
+#ifdef LIBEXCEPT_REGIONS
+typedef struct __libexcept_region
+{
+    struct __libexcept_region* previous;
+    __LIBEXCEPT_JMP_BUF* owner;
+    char* top;
+    char* end;
+    __libexcept_chunk* chunks;
+    struct __libexcept_promoted* promoted;
+    int allocated;
+} __libexcept_region;
+#endif
+
+typedef struct __libexcept_deferred
+{
+    void (*function)(void*);
+    void* argument;
+#ifdef LIBEXCEPT_SJLJ
+    struct __libexcept_deferred* previous;
+    __LIBEXCEPT_JMP_BUF* context;
+#endif
+} __libexcept_deferred;
+
+typedef struct __libexcept_record
+{
+    struct __libexcept_record* previous;
+    const libexcept_type_t* type;
+    const libexcept_site_t* site;
+    const libexcept_message_t* message;
+    char* formatted;
+    char* top;
+    char* end;
+#ifdef LIBEXCEPT_BACKTRACE
+    void** frames;
+    size_t frame_count;
+#endif
+#ifdef LIBEXCEPT_UNWIND
+    struct _Unwind_Exception unwind_exception;
+#endif
+    size_t size;
+    max_align_t payload[];
+} __libexcept_record;
+
+#define __LIBEXCEPT_SAMPLED_TYPES 32
+
+#ifdef LIBEXCEPT_STATISTICS
+typedef struct
+{
+    _Atomic(const libexcept_type_t*) type;
+    _Atomic unsigned long long throws;
+    _Atomic unsigned long long catches;
+} __libexcept_type_counters;
+
+typedef struct __libexcept_counters
+{
+    _Atomic unsigned long long throws;
+    _Atomic unsigned long long catches;
+    _Atomic unsigned long long rethrows;
+    _Atomic unsigned long long unhandled;
+    _Atomic unsigned long long unexpected;
+    _Atomic int max_try_depth;
+    __libexcept_type_counters types[LIBEXCEPT_STATISTICS_TYPES];
+    __libexcept_type_counters untracked;
+    int registered;
+    struct __libexcept_counters* next;
+    struct __libexcept_counters** previous;
+} __libexcept_counters;
+#endif
+
+typedef struct __libexcept_state
+{
+#ifdef LIBEXCEPT_SJLJ
+    _Alignas(64) __LIBEXCEPT_JMP_BUF* context;
+    __libexcept_deferred* deferred;
+    __libexcept_record* current;
+#else
+    _Alignas(64) __libexcept_record* current;
+#endif
+    int depth;
+#ifdef LIBEXCEPT_STATISTICS
+    int try_depth;
+#endif
+#ifdef LIBEXCEPT_THROW_IN
+    _Atomic int injection;
+#endif
+    char* top;
+    char* end;
+    __libexcept_record* pending;
+    const libexcept_type_t* display[LIBEXCEPT_MAX_TYPE_DEPTH];
+    __libexcept_chunk* chunks;
+    int unexpected;
+#ifdef LIBEXCEPT_REGIONS
+    struct __libexcept_region* region;
+    char* region_top;
+    char* region_end;
+    __libexcept_chunk* region_chunks;
+#endif
+#ifdef LIBEXCEPT_UNWIND
+    int unwinding;
+#endif
+#ifdef LIBEXCEPT_STATISTICS
+    __libexcept_counters counters;
+#endif
+#ifdef LIBEXCEPT_RECORDER
+    struct libexcept_recorder_ring* recorder_ring;
+    int recorder_claimed;
+#endif
+#ifdef LIBEXCEPT_THROW_IN
+    _Atomic(struct libexcept_captured*) injected;
+    thrd_t injection_thread;
+    struct __libexcept_state* injection_next;
+#endif
+#ifdef LIBEXCEPT_DEADLINES
+    uint64_t deadline;
+    volatile sig_atomic_t deadline_expired;
+    timer_t deadline_timer;
+    int deadline_timer_created;
+#endif
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+    struct __libexcept_signal_stack* signal_stack;
+#endif
+#ifdef LIBEXCEPT_THREAD_AWARE
+    _Atomic unsigned long long reader_epoch;
+    int reader_registered;
+    struct __libexcept_state* reader_next;
+#endif
+#ifdef LIBEXCEPT_BACKTRACE
+    const libexcept_type_t* sampled_types[__LIBEXCEPT_SAMPLED_TYPES];
+    unsigned sampled_throws[__LIBEXCEPT_SAMPLED_TYPES + 1];
+#endif
+    max_align_t buffer[LIBEXCEPT_ARENA_SIZE / sizeof(max_align_t)];
+} __libexcept_state;
+
+#if defined(LIBEXCEPT_THREAD_AWARE) && defined(__GNUC__)
+#define __LIBEXCEPT_THREAD_LOCAL _Thread_local __attribute__((tls_model(LIBEXCEPT_TLS_MODEL)))
+#elif defined(LIBEXCEPT_THREAD_AWARE)
+#define __LIBEXCEPT_THREAD_LOCAL _Thread_local
+#else
+#define __LIBEXCEPT_THREAD_LOCAL
+#endif
+
+extern __LIBEXCEPT_THREAD_LOCAL __libexcept_state __libexcept_thread;
+
+#ifdef LIBEXCEPT_FIBERS
+extern __LIBEXCEPT_THREAD_LOCAL __libexcept_state* __libexcept_fiber;
+
+#define __LIBEXCEPT_TASK (*(__libexcept_fiber != NULL ? __libexcept_fiber : &__libexcept_thread))
+#else
+#define __LIBEXCEPT_TASK __libexcept_thread
+#endif
+
+#define __LIBEXCEPT_ALIGN(size)                                                                    \
+    (((size) + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t))
+
+/*
+  Calls to these are inserted automatically by the macro system. Direct usage is not intended.
+ */
+
+#ifdef LIBEXCEPT_UNWIND
+void __libexcept_land(void**);
+
+static inline void __libexcept_leave(void** volatile* guard)
+{
+    if (*guard != NULL)
+    {
+        __libexcept_land(*guard);
+    }
+}
+
+static inline void __libexcept_call_deferred(__libexcept_deferred* deferred)
+{
+    deferred->function(deferred->argument);
+}
+#else
+static inline __LIBEXCEPT_JMP_BUF** __libexcept_current_context()
+{
+    return &__LIBEXCEPT_TASK.context;
+}
+
+static inline __libexcept_deferred* __libexcept_defer(__libexcept_deferred* deferred,
+                                                      void (*function)(void*),
+                                                      void* argument)
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    deferred->function = function;
+    deferred->argument = argument;
+    deferred->previous = state->deferred;
+    deferred->context = state->context;
+    state->deferred = deferred;
+    return deferred;
+}
+
+static inline __libexcept_deferred* __libexcept_undefer(__libexcept_deferred* deferred)
+{
+    // Popped first, so that it is not called again if the function throws anyway.
+    __LIBEXCEPT_TASK.deferred = deferred->previous;
+    deferred->function(deferred->argument);
+    return NULL;
+}
+#endif
+
+#ifdef LIBEXCEPT_REGIONS
+void __libexcept_release_region();
+
+static inline void __libexcept_leave_region(__LIBEXCEPT_JMP_BUF* owner)
+{
+    __libexcept_region* region = __LIBEXCEPT_TASK.region;
+    if (region != NULL && region->owner == owner)
+    {
+        __libexcept_release_region();
+    }
+}
+
+#define __LIBEXCEPT_LEAVE_REGION(owner) __libexcept_leave_region(owner)
+#else
+#define __LIBEXCEPT_LEAVE_REGION(owner) (void)0
+#endif
+
+void* __libexcept_allocate_slow(const libexcept_type_t*, size_t);
+noreturn void __libexcept_throw(const libexcept_site_t*);
+noreturn void __libexcept_throw_message(const libexcept_site_t*,
+                                                    libexcept_message_t*,
+                                                    const char*,
+                                                    ...) __LIBEXCEPT_PRINTF(3, 4);
+noreturn void __libexcept_rethrow();
+int __libexcept_handled();
+noreturn void __libexcept_unexpected();
+noreturn void __libexcept_unhandled();
+fenv_t* __libexcept_check_fp(const fenv_t*, int, const libexcept_site_t*);
+
+static inline fenv_t* __libexcept_hold_fp(fenv_t* environment)
+{
+    feholdexcept(environment);
+    return environment;
+}
+
+#ifdef LIBEXCEPT_THROW_IN
+#define __LIBEXCEPT_INJECTION_UNREACHABLE 0
+#define __LIBEXCEPT_INJECTION_IDLE        1
+#define __LIBEXCEPT_INJECTION_PENDING     2
+
+int __libexcept_throw_in(thrd_t,
+                         const libexcept_type_t*,
+                         size_t,
+                         const void*,
+                         const libexcept_site_t*);
+void __libexcept_receive();
+
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+noreturn void __libexcept_expire();
+#endif
+
+#if defined(LIBEXCEPT_THROW_IN) || defined(LIBEXCEPT_DEADLINES)
+static inline int __libexcept_poll()
+{
+#ifdef LIBEXCEPT_THROW_IN
+    if (atomic_load_explicit(&__libexcept_thread.injection, memory_order_relaxed) !=
+        __LIBEXCEPT_INJECTION_IDLE)
+    {
+        __libexcept_receive();
+    }
+#endif
+#ifdef LIBEXCEPT_DEADLINES
+    if (__libexcept_thread.deadline_expired)
+    {
+        __libexcept_expire();
+    }
+#endif
+    return 1;
+}
+
+#define __LIBEXCEPT_POLL() __libexcept_poll()
+#else
+#define __LIBEXCEPT_POLL() 1
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+void __libexcept_enter_deadline(uint64_t);
+void __libexcept_set_deadline(uint64_t);
+
+// Disarms the deadline of a block that is done with its body, unless it kept the one around it.
+static inline int __libexcept_suspend_deadline(uint64_t deadline)
+{
+    if (__libexcept_thread.deadline != deadline)
+    {
+        __libexcept_set_deadline(0);
+        __libexcept_thread.deadline_expired = 0;
+    }
+    return 0;
+}
+
+static inline int __libexcept_restore_deadline(uint64_t deadline)
+{
+    if (__libexcept_thread.deadline != deadline)
+    {
+        __libexcept_set_deadline(deadline);
+    }
+    return 0;
+}
+#endif
+
+#ifdef LIBEXCEPT_SIGNAL_STACKS
+extern _Atomic(int) __libexcept_signal_stacks_wanted;
+void __libexcept_claim_signal_stack();
+
+/*
+  Threads take an alternate signal stack at their first try block after signals start being caught,
+  so that threads which never use libexcept do not take one.
+ */
+static inline void __libexcept_prepare_signal_stack()
+{
+    if (__libexcept_thread.signal_stack == NULL &&
+        atomic_load_explicit(&__libexcept_signal_stacks_wanted, memory_order_relaxed))
+    {
+        __libexcept_claim_signal_stack();
+    }
+}
+
+#define __LIBEXCEPT_PREPARE_SIGNAL_STACK() __libexcept_prepare_signal_stack()
+#else
+#define __LIBEXCEPT_PREPARE_SIGNAL_STACK() (void)0
+#endif
+
+#ifdef LIBEXCEPT_STATISTICS
+void __libexcept_count_try_depth();
+
+static inline void __libexcept_enter()
+{
+    __LIBEXCEPT_PREPARE_SIGNAL_STACK();
+
+    // The counters belong to the thread even when running a fiber.
+    int max_try_depth =
+        atomic_load_explicit(&__libexcept_thread.counters.max_try_depth, memory_order_relaxed);
+
+    if (++__LIBEXCEPT_TASK.try_depth > max_try_depth)
+    {
+        __libexcept_count_try_depth();
+    }
+}
+
+#define __LIBEXCEPT_ENTER() __libexcept_enter()
+#define __LIBEXCEPT_LEAVE() __LIBEXCEPT_TASK.try_depth--
+#else
+#define __LIBEXCEPT_ENTER() __LIBEXCEPT_PREPARE_SIGNAL_STACK()
+#define __LIBEXCEPT_LEAVE() (void)0
+#endif
+
+static inline void* __libexcept_allocate(const libexcept_type_t* id, size_t exception_size)
+{
+    __libexcept_state* state = &__LIBEXCEPT_TASK;
+    size_t size = sizeof(__libexcept_record) + __LIBEXCEPT_ALIGN(exception_size);
+
+    // This also covers the arena not being set up yet, in which case both are NULL.
+    if ((size_t)(state->end - state->top) < size)
+    {
+        return __libexcept_allocate_slow(id, exception_size);
+    }
+
+    __libexcept_record* record = (__libexcept_record*)state->top;
+    record->type = id;
+    record->top = state->top;
+    record->end = state->end;
+    record->size = exception_size;
+    state->top += size;
+    state->pending = record;
+    return record->payload;
+}
+
+static inline int __libexcept_personality(const libexcept_type_t* id)
+{
+    return id->depth <= __LIBEXCEPT_TASK.depth && __LIBEXCEPT_TASK.display[id->depth] == id;
+}
+
+static inline void* __libexcept_current_exception()
+{
+    return __LIBEXCEPT_TASK.current->payload;
+}
 
 #endif // EXCEPT_H
@@ -0,0 +1,596 @@
+/*
+  This file is part of libexcept (https://github.com/VasilisMylonas/libexcept).
+
+  The MIT License (MIT)
+
+  Copyright (c) 2022 Vasilis Mylonas
+
+  Permission is hereby granted, free of charge, to any person obtaining a
+  copy of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+  DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Microbenchmarks for the exception handling keywords and parallel loops.
+
+  One executable is built per combination of the config.h options (see CMakeLists.txt) and each
+  prints one line per benchmark in the form:
+
+  <variant> <benchmark> <ns/op> <cycles/op>
+
+  The number of iterations can be changed by passing it as the first argument.
+ */
+
+#include "except.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+#include <stdatomic.h>
+#include <unistd.h>
+#endif
+
+#ifdef LIBEXCEPT_FIBERS
+#include <ucontext.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES
+static unsigned long long bench_cycles()
+{
+    return __rdtsc();
+}
+#endif
+
+#ifndef LIBEXCEPT_BENCH_VARIANT
+#define LIBEXCEPT_BENCH_VARIANT "default"
+#endif
+
+#define BENCH_MAX_DEPTH 64
+
+typedef struct
+{
+    int value;
+} bench_error_t;
+
+/*
+  Distinct exception types used for the catch chain benchmarks.
+ */
+
+typedef bench_error_t bench_error_0_t;
+typedef struct { int value; } bench_error_1_t;
+typedef struct { int value; } bench_error_2_t;
+typedef struct { int value; } bench_error_3_t;
+typedef struct { int value; } bench_error_4_t;
+typedef struct { int value; } bench_error_5_t;
+typedef struct { int value; } bench_error_6_t;
+typedef struct { int value; } bench_error_7_t;
+typedef struct { int value; } bench_error_8_t;
+typedef struct { int value; } bench_error_9_t;
+typedef struct { int value; } bench_error_10_t;
+typedef struct { int value; } bench_error_11_t;
+typedef struct { int value; } bench_error_12_t;
+typedef struct { int value; } bench_error_13_t;
+typedef struct { int value; } bench_error_14_t;
+typedef struct { int value; } bench_error_15_t;
+
+LIBEXCEPT_LOCAL_TYPE(bench_error_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_0_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_1_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_2_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_3_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_4_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_5_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_6_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_7_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_8_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_9_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_10_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_11_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_12_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_13_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_14_t);
+LIBEXCEPT_LOCAL_TYPE(bench_error_15_t);
+
+/*
+  A hierarchy of LIBEXCEPT_MAX_TYPE_DEPTH types for catching by the root type.
+ */
+
+typedef bench_error_t bench_level_0_t;
+typedef bench_error_t bench_level_1_t;
+typedef bench_error_t bench_level_2_t;
+typedef bench_error_t bench_level_3_t;
+typedef bench_error_t bench_level_4_t;
+typedef bench_error_t bench_level_5_t;
+typedef bench_error_t bench_level_6_t;
+typedef bench_error_t bench_level_7_t;
+
+LIBEXCEPT_LOCAL_TYPE(bench_level_0_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_1_t, bench_level_0_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_2_t, bench_level_1_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_3_t, bench_level_2_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_4_t, bench_level_3_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_5_t, bench_level_4_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_6_t, bench_level_5_t);
+LIBEXCEPT_LOCAL_SUBTYPE(bench_level_7_t, bench_level_6_t);
+
+/*
+  Written to from benchmark bodies so that the compiler can not remove them.
+ */
+static volatile int bench_sink;
+
+static void bench_noop_hook(void* exception)
+{
+    (void)exception;
+    bench_sink++;
+}
+
+static double bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void bench_report(const char* name, size_t iterations, double ns, unsigned long long cycles)
+{
+    printf("%-32s %-32s %10.2f ", LIBEXCEPT_BENCH_VARIANT, name, ns / (double)iterations);
+#ifdef BENCH_HAVE_CYCLES
+    printf("%10.1f\n", (double)cycles / (double)iterations);
+#else
+    (void)cycles;
+    printf("%10s\n", "-");
+#endif
+}
+
+/*
+  Runs body(iterations, arg) once to warm up and then once more while measuring.
+ */
+static void bench_run(const char* name, void (*body)(size_t, int), size_t iterations, int arg)
+{
+    body(iterations / 16 + 1, arg);
+
+    unsigned long long cycles = 0;
+    double start = bench_now_ns();
+#ifdef BENCH_HAVE_CYCLES
+    cycles = bench_cycles();
+#endif
+    body(iterations, arg);
+#ifdef BENCH_HAVE_CYCLES
+    cycles = bench_cycles() - cycles;
+#endif
+    double end = bench_now_ns();
+
+    bench_report(name, iterations, end - start, cycles);
+}
+
+static void bench_try_empty(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            bench_sink++;
+        }
+        catch (bench_error_t, e)
+        {
+            bench_sink += e.value;
+        }
+    }
+}
+
+static void bench_try_finally(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            bench_sink++;
+        }
+        finally
+        {
+            bench_sink--;
+        }
+    }
+}
+
+static void bench_decrement(void* argument)
+{
+    (void)argument;
+    bench_sink--;
+}
+
+static void bench_defer(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        defer (bench_decrement, NULL)
+        {
+            bench_sink++;
+        }
+    }
+}
+
+static void bench_nested_throw(int depth)
+{
+    if (depth == 0)
+    {
+        throw(bench_error_t, {.value = 1});
+    }
+
+    try
+    {
+        bench_nested_throw(depth - 1);
+    }
+    catch (bench_error_1_t, e)
+    {
+        bench_sink += e.value;
+    }
+}
+
+/*
+  Throws from depth - 1 nested try blocks (none of which match) and catches at the outermost one.
+ */
+static void bench_throw_depth(size_t iterations, int depth)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            bench_nested_throw(depth - 1);
+        }
+        catch (bench_error_t, e)
+        {
+            bench_sink += e.value;
+        }
+    }
+}
+
+static void bench_nested_rethrow(int depth)
+{
+    if (depth == 0)
+    {
+        throw(bench_error_t, {.value = 1});
+    }
+
+    try
+    {
+        bench_nested_rethrow(depth - 1);
+    }
+    catch (bench_error_t, e)
+    {
+        rethrow();
+    }
+}
+
+static void bench_rethrow_depth(size_t iterations, int depth)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            bench_nested_rethrow(depth);
+        }
+        catch (bench_error_t, e)
+        {
+            bench_sink += e.value;
+        }
+    }
+}
+
+static void bench_throw_hooked(size_t iterations, int arg)
+{
+    libexcept_on_throw = bench_noop_hook;
+    bench_throw_depth(iterations, arg);
+    libexcept_on_throw = NULL;
+}
+
+#define BENCH_CATCH(n)                                                                             \
+    catch (bench_error_##n##_t, e)                                                                 \
+    {                                                                                              \
+        bench_sink += e.value;                                                                     \
+    }
+
+static void bench_catch_chain_1(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            throw(bench_error_0_t, {.value = 1});
+        }
+        BENCH_CATCH(0)
+    }
+}
+
+static void bench_catch_chain_4(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            throw(bench_error_3_t, {.value = 1});
+        }
+        BENCH_CATCH(0) BENCH_CATCH(1) BENCH_CATCH(2) BENCH_CATCH(3)
+    }
+}
+
+static void bench_catch_chain_16(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            throw(bench_error_15_t, {.value = 1});
+        }
+        BENCH_CATCH(0) BENCH_CATCH(1) BENCH_CATCH(2) BENCH_CATCH(3)
+        BENCH_CATCH(4) BENCH_CATCH(5) BENCH_CATCH(6) BENCH_CATCH(7)
+        BENCH_CATCH(8) BENCH_CATCH(9) BENCH_CATCH(10) BENCH_CATCH(11)
+        BENCH_CATCH(12) BENCH_CATCH(13) BENCH_CATCH(14) BENCH_CATCH(15)
+    }
+}
+
+/*
+  Throws the deepest type of the hierarchy and catches it by its root after a non-matching clause.
+ */
+static void bench_catch_base(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try
+        {
+            throw(bench_level_7_t, {.value = 1});
+        }
+        BENCH_CATCH(1)
+        catch (bench_level_0_t, e)
+        {
+            bench_sink += e.value;
+        }
+    }
+}
+
+#ifdef LIBEXCEPT_THROW_IN
+static void bench_check(size_t iterations, int arg)
+{
+    (void)arg;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        libexcept_check();
+        bench_sink++;
+    }
+}
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+static void bench_enter_deadlines(size_t iterations, uint64_t nanoseconds)
+{
+    for (size_t i = 0; i < iterations; i++)
+    {
+        try_deadline (nanoseconds)
+        {
+            bench_sink++;
+        }
+    }
+}
+
+/*
+  Enters blocks with a deadline, either with none in effect or within a block whose earlier
+  deadline they collapse to.
+ */
+static void bench_try_deadline(size_t iterations, int nested)
+{
+    if (!nested)
+    {
+        bench_enter_deadlines(iterations, 1000000000);
+        return;
+    }
+
+    try_deadline (1000000000)
+    {
+        bench_enter_deadlines(iterations, 2000000000);
+    }
+    catch (deadline_exceeded_t, e)
+    {
+        bench_sink++;
+    }
+}
+#endif
+
+#ifdef LIBEXCEPT_FIBERS
+/*
+  A scheduler switching back and forth between itself and a fiber, with and without switching the
+  exception state too. The fiber is inside a try block while suspended.
+ */
+
+static ucontext_t bench_scheduler;
+static ucontext_t bench_fiber;
+static libexcept_fiber_t* bench_fiber_state;
+static int bench_switch_exceptions;
+
+static void bench_fiber_main()
+{
+    for (;;)
+    {
+        try
+        {
+            if (bench_switch_exceptions)
+            {
+                libexcept_set_fiber(NULL);
+            }
+            swapcontext(&bench_fiber, &bench_scheduler);
+        }
+        finally
+        {
+        }
+    }
+}
+
+static void bench_fiber_switch(size_t iterations, int switch_exceptions)
+{
+    static char stack[64 * 1024];
+
+    bench_switch_exceptions = switch_exceptions;
+    bench_fiber_state = libexcept_create_fiber();
+    getcontext(&bench_fiber);
+    bench_fiber.uc_stack.ss_sp = stack;
+    bench_fiber.uc_stack.ss_size = sizeof(stack);
+    makecontext(&bench_fiber, bench_fiber_main, 0);
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        if (switch_exceptions)
+        {
+            libexcept_set_fiber(bench_fiber_state);
+        }
+        swapcontext(&bench_scheduler, &bench_fiber);
+    }
+
+    libexcept_destroy_fiber(bench_fiber_state);
+}
+#endif
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+/*
+  Measures the time from a task of a parallel loop throwing to the loop rethrowing its exception,
+  which includes waiting for every other thread to notice the cancellation and return.
+ */
+
+static _Atomic unsigned bench_running;
+static double bench_thrown_at;
+static unsigned long long bench_thrown_cycles;
+
+static void bench_cancelled_task(size_t index, void* argument)
+{
+    unsigned threads = *(unsigned*)argument;
+
+    if (index != 0)
+    {
+        atomic_fetch_add(&bench_running, 1);
+        while (!libexcept_cancelled())
+        {
+        }
+        return;
+    }
+
+    // Throw once every other thread is busy in its task.
+    while (atomic_load(&bench_running) != threads - 1)
+    {
+    }
+    bench_thrown_at = bench_now_ns();
+#ifdef BENCH_HAVE_CYCLES
+    bench_thrown_cycles = bench_cycles();
+#endif
+    throw(bench_error_t, {.value = 1});
+}
+
+static void bench_parallel_cancel(size_t iterations, unsigned threads)
+{
+    double ns = 0;
+    unsigned long long cycles = 0;
+
+    for (size_t i = 0; i < iterations; i++)
+    {
+        atomic_store(&bench_running, 0);
+        try
+        {
+            libexcept_parallel_for(threads, bench_cancelled_task, &threads, threads,
+                                   LIBEXCEPT_FAIL_FIRST);
+        }
+        catch (bench_error_t, e)
+        {
+            ns += bench_now_ns() - bench_thrown_at;
+#ifdef BENCH_HAVE_CYCLES
+            cycles += bench_cycles() - bench_thrown_cycles;
+#endif
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "parallel_cancel_threads_%u", threads);
+    bench_report(name, iterations, ns, cycles);
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = 1000000;
+    if (argc > 1)
+    {
+        iterations = strtoull(argv[1], NULL, 10);
+    }
+
+    char name[64];
+
+    bench_run("try_empty", bench_try_empty, iterations, 0);
+    bench_run("try_finally", bench_try_finally, iterations, 0);
+    bench_run("defer", bench_defer, iterations, 0);
+
+    for (int depth = 1; depth <= BENCH_MAX_DEPTH; depth *= 2)
+    {
+        snprintf(name, sizeof(name), "throw_catch_depth_%d", depth);
+        bench_run(name, bench_throw_depth, iterations / depth, depth);
+    }
+
+    bench_run("catch_chain_1", bench_catch_chain_1, iterations, 0);
+    bench_run("catch_chain_4", bench_catch_chain_4, iterations, 0);
+    bench_run("catch_chain_16", bench_catch_chain_16, iterations, 0);
+    bench_run("catch_base_depth_7", bench_catch_base, iterations, 0);
+
+    for (int depth = 1; depth <= BENCH_MAX_DEPTH; depth *= 2)
+    {
+        snprintf(name, sizeof(name), "rethrow_depth_%d", depth);
+        bench_run(name, bench_rethrow_depth, iterations / depth, depth);
+    }
+
+    bench_run("throw_hooked", bench_throw_hooked, iterations, 1);
+
+#ifdef LIBEXCEPT_THROW_IN
+    bench_run("check", bench_check, iterations, 0);
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+    bench_run("try_deadline", bench_try_deadline, iterations, 0);
+    bench_run("try_deadline_nested", bench_try_deadline, iterations, 1);
+#endif
+
+#ifdef LIBEXCEPT_FIBERS
+    bench_run("fiber_switch", bench_fiber_switch, iterations, 0);
+    bench_run("fiber_switch_exceptions", bench_fiber_switch, iterations, 1);
+#endif
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned processors = online > 0 ? (unsigned)online : 1;
+    for (unsigned threads = 1; threads < processors; threads *= 2)
+    {
+        bench_parallel_cancel(iterations / 10000 + 1, threads);
+    }
+    bench_parallel_cancel(iterations / 10000 + 1, processors);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+  This file is part of libexcept (https://github.com/VasilisMylonas/libexcept).
+
+  The MIT License (MIT)
+
+  Copyright (c) 2022 Vasilis Mylonas
+
+  Permission is hereby granted, free of charge, to any person obtaining a
+  copy of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+  DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+  Prints the exceptions stored in a flight recorder file, oldest first, in the form:
+
+  <time> thread <id> <type> thrown at <file>:<line> in <function>() [<payload bytes>]
+
+  Usage: except_decode <file>
+ */
+
+#include "except_recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static int compare_entries(const void* a, const void* b)
+{
+    const libexcept_recorder_entry_t* first = *(libexcept_recorder_entry_t* const*)a;
+    const libexcept_recorder_entry_t* second = *(libexcept_recorder_entry_t* const*)b;
+
+    if (first->timestamp != second->timestamp)
+    {
+        return first->timestamp < second->timestamp ? -1 : 1;
+    }
+    return first->sequence < second->sequence ? -1 : first->sequence > second->sequence;
+}
+
+static void print_entry(const libexcept_recorder_entry_t* entry)
+{
+    static const char* severities[] = {"info", "warning", "error", "fatal"};
+
+    char time[32];
+    time_t seconds = (time_t)(entry->timestamp / 1000000000);
+    strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", gmtime(&seconds));
+
+    printf("%s.%09lluZ thread %llu %s", time,
+           (unsigned long long)(entry->timestamp % 1000000000),
+           (unsigned long long)entry->thread, entry->type);
+
+    if (entry->file[0] != '\0')
+    {
+        printf(" thrown at %s:%u in %s()", entry->file, (unsigned)entry->line, entry->function);
+    }
+
+    if (entry->severity < sizeof(severities) / sizeof(severities[0]))
+    {
+        printf(" (%s)", severities[entry->severity]);
+    }
+
+    printf(" [");
+    uint32_t size = entry->payload_size < LIBEXCEPT_RECORDER_PAYLOAD ? entry->payload_size
+                                                                      : LIBEXCEPT_RECORDER_PAYLOAD;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        printf(i == 0 ? "%02x" : " %02x", entry->payload[i]);
+    }
+    printf(size < entry->payload_size ? " ...]\n" : "]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    libexcept_recorder_header_t* header = malloc(size > 0 ? size : 1);
+    if (header == NULL || fread(header, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "%s: could not read file\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    if ((size_t)size < sizeof(libexcept_recorder_header_t) ||
+        memcmp(header->magic, LIBEXCEPT_RECORDER_MAGIC, sizeof(header->magic)) != 0)
+    {
+        fprintf(stderr, "%s: not a libexcept recorder file\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if (header->version != LIBEXCEPT_RECORDER_VERSION ||
+        header->entry_count != LIBEXCEPT_RECORDER_ENTRIES ||
+        header->entry_size != sizeof(libexcept_recorder_entry_t) ||
+        (size_t)size < sizeof(libexcept_recorder_header_t) +
+                           header->ring_count * sizeof(libexcept_recorder_ring_t))
+    {
+        fprintf(stderr, "%s: unsupported recorder version or layout\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    size_t count = 0;
+    libexcept_recorder_entry_t** entries =
+        malloc(header->ring_count * LIBEXCEPT_RECORDER_ENTRIES * sizeof(*entries) + 1);
+    if (entries == NULL)
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < header->ring_count; i++)
+    {
+        for (uint32_t j = 0; j < LIBEXCEPT_RECORDER_ENTRIES; j++)
+        {
+            // Entries with no sequence are either unused or were interrupted while written.
+            if (header->rings[i].entries[j].sequence != 0)
+            {
+                entries[count++] = &header->rings[i].entries[j];
+            }
+        }
+    }
+
+    qsort(entries, count, sizeof(*entries), compare_entries);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        print_entry(entries[i]);
+    }
+
+    if (header->dropped != 0)
+    {
+        printf("%llu exceptions were not recorded\n", (unsigned long long)header->dropped);
+    }
+
+    free(entries);
+    free(header);
+    return EXIT_SUCCESS;
+}
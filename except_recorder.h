@@ -0,0 +1,110 @@
+/*
+  This file is part of libexcept (https://github.com/VasilisMylonas/libexcept).
+
+  The MIT License (MIT)
+
+  Copyright (c) 2022 Vasilis Mylonas
+
+  Permission is hereby granted, free of charge, to any person obtaining a
+  copy of this software and associated documentation files (the "Software"),
+  to deal in the Software without restriction, including without limitation
+  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+  and/or sell copies of the Software, and to permit persons to whom the
+  Software is furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+  DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef EXCEPT_RECORDER_H
+#define EXCEPT_RECORDER_H
+
+/**
+ * @file except_recorder.h
+ * @brief Layout of the files written by the libexcept flight recorder.
+ *
+ * A recorder file consists of a header followed by a number of rings, each of which is owned by
+ * one thread at a time. Every throw appends an entry to the ring of its thread, overwriting the
+ * oldest entry once the ring is full. Entries are only ever written by their owning thread.
+ *
+ * An entry is complete when its sequence number is not 0. The sequence is cleared before the
+ * entry is written and set afterwards, so that an entry interrupted by a crash can be recognized.
+ * All integers are stored in the byte order of the recording machine.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Identifies recorder files, including the terminating null character.
+ */
+#define LIBEXCEPT_RECORDER_MAGIC "LIBXREC"
+
+#define LIBEXCEPT_RECORDER_VERSION 1
+
+/**
+ * The number of entries in each ring.
+ */
+#define LIBEXCEPT_RECORDER_ENTRIES 128
+
+/**
+ * The sizes of the text fields of an entry, which are truncated to fit and always null terminated.
+ */
+#define LIBEXCEPT_RECORDER_TYPE     32
+#define LIBEXCEPT_RECORDER_FILE     64
+#define LIBEXCEPT_RECORDER_FUNCTION 32
+
+/**
+ * The number of leading bytes of the thrown object that are recorded.
+ */
+#define LIBEXCEPT_RECORDER_PAYLOAD 32
+
+typedef struct
+{
+    /** Position of the entry among all entries of its ring, starting from 1. */
+    _Atomic uint64_t sequence;
+    /** Time of the throw in nanoseconds since the epoch. */
+    uint64_t timestamp;
+    /** The operating system identifier of the throwing thread. */
+    uint64_t thread;
+    uint32_t line;
+    uint32_t severity;
+    /** The size of the thrown object. Only its first LIBEXCEPT_RECORDER_PAYLOAD bytes are kept. */
+    uint32_t payload_size;
+    uint32_t reserved;
+    char type[LIBEXCEPT_RECORDER_TYPE];
+    char file[LIBEXCEPT_RECORDER_FILE];
+    char function[LIBEXCEPT_RECORDER_FUNCTION];
+    unsigned char payload[LIBEXCEPT_RECORDER_PAYLOAD];
+} libexcept_recorder_entry_t;
+
+typedef struct libexcept_recorder_ring
+{
+    /** The identifier of the owning thread or 0 if the ring is free. */
+    _Atomic uint64_t owner;
+    /** The number of entries ever written to the ring. */
+    uint64_t head;
+    libexcept_recorder_entry_t entries[LIBEXCEPT_RECORDER_ENTRIES];
+} libexcept_recorder_ring_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ring_count;
+    uint32_t entry_count;
+    uint32_t entry_size;
+    /** Throws that were not recorded because their thread could not get a ring. */
+    _Atomic uint64_t dropped;
+    libexcept_recorder_ring_t rings[];
+} libexcept_recorder_header_t;
+
+#endif // EXCEPT_RECORDER_H
@@ -1,13 +1,21 @@
+// The tests are assertions, so they are kept in release builds.
+#undef NDEBUG
+
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
 
 #include "except.h"
 
 void test_throw()
 {
-    bool exec_try = false;
-    bool exec_catch = false;
-    bool exec_finally = false;
+    volatile bool exec_try = false;
+    volatile bool exec_catch = false;
+    volatile bool exec_finally = false;
 
     try
     {
@@ -31,9 +39,9 @@ void test_throw()
 
 void test_no_throw()
 {
-    bool exec_try = false;
-    bool exec_catch = false;
-    bool exec_finally = false;
+    volatile bool exec_try = false;
+    volatile bool exec_catch = false;
+    volatile bool exec_finally = false;
 
     try
     {
@@ -53,32 +61,1473 @@ void test_no_throw()
     assert(exec_finally);
 }
 
-#include <signal.h>
+typedef int error_code_t;
+LIBEXCEPT_LOCAL_TYPE(error_code_t);
 
-void test_signal()
+void test_type_identity()
 {
-    libexcept_enable_sigcatch();
+    volatile bool caught_int = false;
+    volatile bool caught_error_code = false;
+
+    try
+    {
+        // A typedef is a distinct exception type.
+        throw(error_code_t, EINVAL);
+    }
+    catch (int, e)
+    {
+        caught_int = true;
+    }
+    catch (error_code_t, e)
+    {
+        caught_error_code = e == EINVAL;
+        assert(libexcept_exception_type() == LIBEXCEPT_TYPE(error_code_t));
+        assert(strcmp(libexcept_exception_type()->name, "error_code_t") == 0);
+    }
+
+    assert(!caught_int);
+    assert(caught_error_code);
+
+    // Built-in types spelled with several keywords are distinct from each other.
+    volatile unsigned long caught_unsigned_long = 0;
+    try
+    {
+        throw(unsigned long, 42);
+    }
+    catch (long, e)
+    {
+        assert(false);
+    }
+    catch (long long, e)
+    {
+        assert(false);
+    }
+    catch (unsigned long, e)
+    {
+        caught_unsigned_long = e;
+        assert(strcmp(libexcept_exception_type()->name, "unsigned long") == 0);
+    }
+
+    assert(caught_unsigned_long == 42);
+    assert(LIBEXCEPT_TYPE(signed) == LIBEXCEPT_TYPE(int));
+    assert(LIBEXCEPT_TYPE(unsigned int) == LIBEXCEPT_TYPE(unsigned));
+    assert(LIBEXCEPT_TYPE(long double) != LIBEXCEPT_TYPE(double));
+}
+
+typedef struct
+{
+    int code;
+} base_error_t;
+
+typedef struct
+{
+    base_error_t base;
+} derived_error_t;
+
+typedef struct
+{
+    derived_error_t base;
+    const char* detail;
+} most_derived_error_t;
+
+LIBEXCEPT_LOCAL_TYPE(base_error_t);
+LIBEXCEPT_LOCAL_SUBTYPE(derived_error_t, base_error_t);
+LIBEXCEPT_LOCAL_SUBTYPE(most_derived_error_t, derived_error_t);
+
+void test_type_hierarchy()
+{
+    volatile int caught_code = 0;
+    volatile bool caught_derived = false;
+
+    try
+    {
+        throw(most_derived_error_t, {.base.base.code = 42, .detail = "detail"});
+    }
+    catch (int, e)
+    {
+        assert(false);
+    }
+    catch (base_error_t, e)
+    {
+        caught_code = e.code;
+        assert(libexcept_exception_type() == LIBEXCEPT_TYPE(most_derived_error_t));
+    }
+
+    assert(caught_code == 42);
+
+    try
+    {
+        // A base type must not be caught as one of its derived types.
+        try
+        {
+            throw(base_error_t, {.code = 1});
+        }
+        catch (derived_error_t, e)
+        {
+            assert(false);
+        }
+    }
+    catch (base_error_t, e)
+    {
+        caught_code = e.code;
+    }
+
+    assert(caught_code == 1);
+
+    try
+    {
+        throw(derived_error_t, {.base.code = 2});
+    }
+    catch (most_derived_error_t, e)
+    {
+        assert(false);
+    }
+    catch (derived_error_t, e)
+    {
+        caught_derived = e.base.code == 2;
+    }
+
+    assert(caught_derived);
+}
+
+typedef struct
+{
+    size_t length;
+    char data[4 * LIBEXCEPT_ARENA_SIZE];
+} large_error_t;
+
+LIBEXCEPT_LOCAL_TYPE(large_error_t);
+
+void test_large_exception()
+{
+    volatile size_t length = 0;
+
+    try
+    {
+        throw_new (large_error_t, error)
+        {
+            memset(error->data, 'x', sizeof(error->data));
+            error->length = sizeof(error->data);
+        }
+    }
+    catch_ref (large_error_t, error)
+    {
+        length = error->length;
+        assert(error->data[sizeof(error->data) - 1] == 'x');
+    }
+
+    assert(length == sizeof(((large_error_t*)NULL)->data));
+}
+
+void test_throw_site()
+{
+    volatile int line = 0;
+
+    try
+    {
+        try
+        {
+            line = __LINE__ + 1;
+            throw(int, 1);
+        }
+        catch (int, e)
+        {
+            rethrow();
+        }
+    }
+    catch (int, e)
+    {
+        // Rethrowing keeps the original site.
+        const libexcept_site_t* site = libexcept_exception_site();
+        assert(site != NULL);
+        assert(site->type == LIBEXCEPT_TYPE(int));
+        assert(site->line == line);
+        assert(strcmp(site->function, "test_throw_site") == 0);
+        assert(strstr(site->file, "except_test.c") != NULL);
+        assert(site->severity == LIBEXCEPT_SEVERITY_ERROR);
+    }
+
+#undef LIBEXCEPT_THROW_SEVERITY
+#define LIBEXCEPT_THROW_SEVERITY LIBEXCEPT_SEVERITY_WARNING
+    try
+    {
+        throw_new (int, e)
+        {
+            *e = 1;
+        }
+    }
+    catch (int, e)
+    {
+        const libexcept_site_t* site = libexcept_exception_site();
+#ifdef __GNUC__
+        assert(site != NULL);
+        assert(site->severity == LIBEXCEPT_SEVERITY_WARNING);
+#else
+        assert(site == NULL);
+#endif
+    }
+#undef LIBEXCEPT_THROW_SEVERITY
+#define LIBEXCEPT_THROW_SEVERITY LIBEXCEPT_SEVERITY_ERROR
+}
+
+typedef struct
+{
+    libexcept_message_t message;
+    int code;
+} message_error_t;
+
+LIBEXCEPT_LOCAL_TYPE(message_error_t);
+
+void test_message()
+{
+    char expected[128];
+    char copy[16];
+    size_t length = 0;
+    long long offset = -42;
+
+    try
+    {
+        throw_message (message_error_t,
+                       "read of %zu bytes at %lld failed: %s (%d%%) %5.2f|%*d|%hhd", (size_t)512,
+                       offset, "EIO", 100, 3.14159, 4, 7, 300);
+    }
+    catch (message_error_t, e)
+    {
+        snprintf(expected, sizeof(expected),
+                 "read of %zu bytes at %lld failed: %s (%d%%) %5.2f|%*d|%hhd", (size_t)512,
+                 offset, "EIO", 100, 3.14159, 4, 7, (signed char)300);
+
+        const char* message = libexcept_exception_message();
+        assert(strcmp(message, expected) == 0);
+        assert(libexcept_exception_message() == message);
+        assert(e.code == 0);
+
+        // Copies can be formatted after the exception was handled.
+        length = libexcept_format_message(&e.message, copy, sizeof(copy));
+    }
+
+    assert(length == strlen(expected));
+    assert(strncmp(copy, expected, sizeof(copy) - 1) == 0);
+    assert(copy[sizeof(copy) - 1] == '\0');
+
+    try
+    {
+        throw_message (message_error_t, "%c %-*.*s|%.*d|%p", 'x', 6, 2, "abcdef", -1, 5,
+                       (void*)copy);
+    }
+    catch (message_error_t, e)
+    {
+        snprintf(expected, sizeof(expected), "%c %-*.*s|%.*d|%p", 'x', 6, 2, "abcdef", -1, 5,
+                 (void*)copy);
+        assert(strcmp(libexcept_exception_message(), expected) == 0);
+    }
+
+    try
+    {
+        // The message ends at the first value that does not fit.
+        throw_message (message_error_t, "%d %d %d %d %d %d %d %d %d end", 1, 2, 3, 4, 5, 6, 7, 8,
+                       9);
+    }
+    catch (message_error_t, e)
+    {
+        assert(strcmp(libexcept_exception_message(), "1 2 3 4 5 6 7 8 ") == 0);
+    }
+}
+
+void test_nested_exception()
+{
+    volatile int outer = 0;
+    volatile int inner = 0;
+
+    try
+    {
+        try
+        {
+            throw(int, 1);
+        }
+        catch (int, e)
+        {
+            // Handling another exception must not disturb the one currently being handled.
+            try
+            {
+                throw_new (large_error_t, error)
+                {
+                    error->length = 2;
+                }
+            }
+            catch_ref (large_error_t, error)
+            {
+                inner = (int)error->length;
+            }
+
+            rethrow();
+        }
+    }
+    catch (int, e)
+    {
+        outer = e;
+    }
+
+    assert(inner == 2);
+    assert(outer == 1);
+    assert(libexcept_exception_type() == NULL);
+}
+
+int capture_error(void* arg)
+{
+    try
+    {
+        throw_message (message_error_t, "code %d", 42);
+    }
+    catch_any
+    {
+        *(libexcept_captured_t**)arg = libexcept_capture();
+    }
+    return 0;
+}
+
+void test_captured_exception()
+{
+    libexcept_captured_t* captured = NULL;
+    assert(libexcept_capture() == NULL);
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    // Exceptions thrown in one thread are rethrown in another with their type and message intact.
+    thrd_t thread;
+    thrd_create(&thread, capture_error, &captured);
+    thrd_join(thread, NULL);
+#else
+    capture_error(&captured);
+#endif
+
+    assert(captured != NULL);
+    assert(libexcept_captured_type(captured) == LIBEXCEPT_TYPE(message_error_t));
+    const message_error_t* value = libexcept_captured_value(captured);
+    assert(value->message.arguments[0].i == 42);
+
+    for (int i = 0; i < 2; i++)
+    {
+        bool caught = false;
+        try
+        {
+            libexcept_rethrow_captured(libexcept_retain(captured));
+        }
+        catch_ref (message_error_t, error)
+        {
+            caught = error->message.arguments[0].i == 42;
+            assert(strcmp(libexcept_exception_message(), "code 42") == 0);
+            assert(strcmp(libexcept_exception_site()->function, "capture_error") == 0);
+        }
+        assert(caught);
+    }
+
+    libexcept_release(captured);
+}
+
+void test_checked_fp()
+{
+    volatile double zero = 0.0;
+    volatile double result = 0.0;
+    const char* volatile message = NULL;
+    volatile int line = 0;
+
+    // Flags raised before a block are kept and inexact results are not checked by default.
+    feclearexcept(FE_ALL_EXCEPT);
+    feraiseexcept(FE_UNDERFLOW);
+    checked_fp
+    {
+        result = 1.0 / 3.0 + zero;
+    }
+    assert(fetestexcept(FE_UNDERFLOW));
 
-    bool error_caught = false;
     try
     {
-        raise(SIGFPE);
+        line = __LINE__ + 1;
+        checked_fp
+        {
+            result = 1.0 / zero;
+            result = -result * zero;
+        }
     }
     catch (arithmetic_error_t, e)
     {
-        error_caught = true;
+        message = e.message;
+        assert(libexcept_exception_site()->line == line);
     }
 
-    assert(error_caught);
+    // Both a division by zero and an invalid operation happened, the latter is reported.
+    assert(strcmp(message, "Invalid floating point operation.") == 0);
+    assert(!fetestexcept(FE_DIVBYZERO | FE_INVALID));
+    (void)result;
+}
 
-    libexcept_disable_sigcatch();
+static char deferred_calls[8];
+
+static void append_call(void* name)
+{
+    strcat(deferred_calls, name);
+}
+
+static void throw_deferred()
+{
+    defer (append_call, "a")
+    {
+        defer (append_call, "b")
+        {
+            throw(int, 1);
+        }
+    }
+}
+
+void test_defer()
+{
+    defer (append_call, "a")
+    {
+        defer (append_call, "b")
+        {
+            assert(deferred_calls[0] == '\0');
+        }
+    }
+    assert(strcmp(deferred_calls, "ba") == 0);
+
+    // Calls are made before the catch clause, innermost first.
+    deferred_calls[0] = '\0';
+    try
+    {
+        throw_deferred();
+    }
+    catch (int, e)
+    {
+        assert(strcmp(deferred_calls, "ba") == 0);
+    }
+
+    // Blocks entered before the try block that catches are left alone.
+    deferred_calls[0] = '\0';
+    defer (append_call, "c")
+    {
+        try
+        {
+            defer (append_call, "d")
+            {
+                throw(int, 2);
+            }
+        }
+        catch (int, e)
+        {
+            assert(strcmp(deferred_calls, "d") == 0);
+        }
+    }
+    assert(strcmp(deferred_calls, "dc") == 0);
+
+    // Propagating out of a try block calls the blocks entered before it.
+    deferred_calls[0] = '\0';
+    try
+    {
+        defer (append_call, "e")
+        {
+            try
+            {
+                defer (append_call, "f")
+                {
+                    throw(int, 3);
+                }
+            }
+            catch (float, e)
+            {
+            }
+        }
+    }
+    catch (int, e)
+    {
+        assert(strcmp(deferred_calls, "fe") == 0);
+    }
+}
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+static void add_index(size_t index, void* argument)
+{
+    atomic_fetch_add((_Atomic size_t*)argument, index);
+}
+
+static void fail_at_ten(size_t index, void* argument)
+{
+    if (index == 10)
+    {
+        throw(int, 10);
+    }
+
+    // Every other task waits for the failure, so all of them are cancelled.
+    while (!libexcept_cancelled())
+    {
+        thrd_yield();
+    }
+    atomic_fetch_add((_Atomic int*)argument, 1);
+}
+
+static void fail_every(size_t index, void* argument)
+{
+    (void)argument;
+    throw(unsigned, (unsigned)index);
+}
+
+void test_parallel_for()
+{
+    _Atomic size_t sum = 0;
+    libexcept_parallel_for(1000, add_index, (void*)&sum, 4, LIBEXCEPT_FAIL_FIRST);
+    assert(sum == 999 * 1000 / 2);
+    assert(!libexcept_cancelled());
+
+    // Tasks that started before the failure return once cancelled, the rest never start.
+    _Atomic int cancelled = 0;
+    int caught = 0;
+    try
+    {
+        libexcept_parallel_for(11, fail_at_ten, (void*)&cancelled, 11, LIBEXCEPT_FAIL_FIRST);
+    }
+    catch (int, e)
+    {
+        caught = e;
+    }
+    assert(caught == 10);
+    assert(cancelled <= 10);
+
+    volatile size_t failed = 0;
+    try
+    {
+        libexcept_parallel_for(64, fail_every, NULL, 4, LIBEXCEPT_FAIL_AGGREGATE);
+    }
+    catch (aggregate_error_t, e)
+    {
+        failed = e.count;
+        assert(libexcept_captured_type(e.errors[0]) == LIBEXCEPT_TYPE(unsigned));
+        libexcept_release_aggregate(&e);
+    }
+    assert(failed >= 1 && failed <= 4);
+}
+
+static libexcept_task_group_t* spawning_group;
+
+static void spawn_halves(size_t index, void* argument)
+{
+    // Tasks may spawn more tasks into their own group.
+    if (index > 1)
+    {
+        libexcept_spawn(spawning_group, spawn_halves, index / 2, argument);
+        libexcept_spawn(spawning_group, spawn_halves, index - index / 2, argument);
+        return;
+    }
+    atomic_fetch_add((_Atomic size_t*)argument, index);
+}
+
+void test_task_group()
+{
+    _Atomic size_t sum = 0;
+    spawning_group = libexcept_create_task_group(LIBEXCEPT_FAIL_FIRST);
+    assert(spawning_group != NULL);
+    libexcept_spawn(spawning_group, spawn_halves, 100, (void*)&sum);
+    libexcept_wait_task_group(spawning_group);
+    assert(sum == 100);
+
+    // Groups are waited for even without tasks.
+    libexcept_wait_task_group(libexcept_create_task_group(LIBEXCEPT_FAIL_FIRST));
+
+    volatile size_t failed = 0;
+    libexcept_task_group_t* group = libexcept_create_task_group(LIBEXCEPT_FAIL_AGGREGATE);
+    try
+    {
+        for (size_t i = 0; i < 3; i++)
+        {
+            libexcept_spawn(group, fail_every, i, NULL);
+        }
+        libexcept_wait_task_group(group);
+    }
+    catch (aggregate_error_t, e)
+    {
+        failed = e.count;
+        libexcept_release_aggregate(&e);
+    }
+    assert(failed >= 1 && failed <= 3);
+}
+#endif
+
+#ifdef LIBEXCEPT_THROW_IN
+static int check_until_thrown_into(void* argument)
+{
+    int caught = 0;
+
+    try
+    {
+        atomic_store((_Atomic int*)argument, 1);
+        for (;;)
+        {
+            libexcept_check();
+        }
+    }
+    catch (int, e)
+    {
+        caught = e;
+    }
+    return caught;
+}
+
+void test_throw_in()
+{
+    // Exceptions thrown into the calling thread are thrown at the start of the next try block, to
+    // the try blocks around it.
+    volatile int delivered = 0;
+    volatile int dropped = 0;
+    volatile bool entered = false;
+    int caught = 0;
+    try
+    {
+        delivered = libexcept_throw_in(thrd_current(), int, 5);
+        dropped = libexcept_throw_in(thrd_current(), int, 6);
+        try
+        {
+            entered = true;
+        }
+        catch (int, e)
+        {
+            assert(false);
+        }
+    }
+    catch (int, e)
+    {
+        caught = e;
+    }
+    assert(delivered && !dropped);
+    assert(caught == 5 && !entered);
+
+    _Atomic int ready = 0;
+    thrd_t thread;
+    thrd_create(&thread, check_until_thrown_into, (void*)&ready);
+    while (!ready)
+    {
+        thrd_yield();
+    }
+
+    delivered = libexcept_throw_in(thread, int, 7);
+    thrd_join(thread, &caught);
+    assert(delivered);
+    assert(caught == 7);
+
+    delivered = libexcept_throw_in(thread, int, 8);
+    assert(!delivered);
+}
+#endif
+
+static void count_event(libexcept_event_t event, void* exception, void* context)
+{
+    assert(event == LIBEXCEPT_EVENT_THROW);
+    assert(*(int*)exception == 7);
+    atomic_fetch_add((_Atomic int*)context, 1);
+}
+
+static void throw_seven(int times)
+{
+    for (volatile int i = 0; i < times; i++)
+    {
+        try
+        {
+            throw(int, 7);
+        }
+        catch (int, e)
+        {
+        }
+    }
+}
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+int throw_sevens(void* arg)
+{
+    (void)arg;
+    throw_seven(10000);
+    return 0;
+}
+#endif
+
+void test_subscribers()
+{
+    _Atomic int first = 0;
+    _Atomic int second = 0;
+
+    libexcept_subscription_t* a = libexcept_subscribe(LIBEXCEPT_EVENT_THROW, count_event, &first);
+    libexcept_subscription_t* b = libexcept_subscribe(LIBEXCEPT_EVENT_THROW, count_event, &second);
+    assert(a != NULL && b != NULL);
+
+    throw_seven(2);
+    assert(first == 2 && second == 2);
+
+    libexcept_unsubscribe(a);
+    throw_seven(1);
+    assert(first == 2 && second == 3);
+
+    libexcept_unsubscribe(b);
+    throw_seven(1);
+    assert(first == 2 && second == 3);
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    // Subscribers come and go while another thread is throwing.
+    thrd_t thread;
+    thrd_create(&thread, throw_sevens, NULL);
+    for (int i = 0; i < 1000; i++)
+    {
+        a = libexcept_subscribe(LIBEXCEPT_EVENT_THROW, count_event, &first);
+        libexcept_unsubscribe(a);
+    }
+    thrd_join(thread, NULL);
+#endif
+}
+
+#ifdef LIBEXCEPT_REGIONS
+static char* copy_region_string(const char* string)
+{
+    size_t size = strlen(string) + 1;
+    return memcpy(libexcept_region_alloc(size), string, size);
+}
+
+void test_regions()
+{
+    char* volatile first = NULL;
+    char* volatile again = NULL;
+    char* volatile promoted = NULL;
+    char* volatile middle = NULL;
+
+    assert(libexcept_region_alloc(1) == NULL);
+
+    try
+    {
+        first = copy_region_string("first");
+        assert(((uintptr_t)first % _Alignof(max_align_t)) == 0);
+    }
+    finally
+    {
+        assert(strcmp(first, "first") == 0);
+    }
+
+    // Released regions are reused, whether their try block completed or threw.
+    try
+    {
+        again = copy_region_string("again");
+        try
+        {
+            char* inner = copy_region_string("inner");
+            promoted = libexcept_region_promote(inner, strlen(inner) + 1);
+            assert(libexcept_region_alloc(8192) != NULL);
+            throw(int, 1);
+        }
+        finally
+        {
+        }
+    }
+    catch (int, e)
+    {
+        assert(strcmp(again, "again") == 0);
+        assert(strcmp(promoted, "inner") == 0);
+    }
+    assert(again == first);
+
+    // Copies go to the immediate parent, which gets a region if it has none yet.
+    try
+    {
+        first = copy_region_string("outer");
+        try
+        {
+            try
+            {
+                char* inner = copy_region_string("inner");
+                promoted = libexcept_region_promote(inner, strlen(inner) + 1);
+            }
+            finally
+            {
+            }
+            middle = copy_region_string("middle");
+            assert(strcmp(promoted, "inner") == 0);
+        }
+        finally
+        {
+            assert(strcmp(middle, "middle") == 0);
+        }
+        assert(strcmp(first, "outer") == 0);
+    }
+    finally
+    {
+    }
+
+    // Without an enclosing try block there is nothing to promote to.
+    try
+    {
+        assert(libexcept_region_promote("x", 2) == NULL);
+        try
+        {
+            assert(libexcept_region_promote("x", 2) != NULL);
+        }
+        finally
+        {
+        }
+    }
+    finally
+    {
+    }
+}
+#endif
+
+#ifdef LIBEXCEPT_FIBERS
+#include <ucontext.h>
+
+static ucontext_t scheduler_context;
+static ucontext_t fiber_contexts[2];
+static libexcept_fiber_t* fibers[2];
+static int fiber_caught[2];
+
+// Switches to a fiber, or back to the scheduler if to is negative, along with its exceptions.
+static void switch_fiber(ucontext_t* from, int to)
+{
+    libexcept_set_fiber(to < 0 ? NULL : fibers[to]);
+    swapcontext(from, to < 0 ? &scheduler_context : &fiber_contexts[to]);
+}
+
+static void run_fiber(int self)
+{
+    try
+    {
+        // The other fiber enters its own try block before this one throws.
+        switch_fiber(&fiber_contexts[self], self == 0 ? 1 : -1);
+        throw(int, self + 1);
+    }
+    catch (int, e)
+    {
+        fiber_caught[self] = e;
+    }
+    switch_fiber(&fiber_contexts[self], -1);
+}
+
+void test_fibers()
+{
+    static char stacks[2][64 * 1024];
+    int caught = 0;
+
+    assert(libexcept_get_fiber() == NULL);
+
+    for (int i = 0; i < 2; i++)
+    {
+        fibers[i] = libexcept_create_fiber();
+        assert(fibers[i] != NULL);
+        getcontext(&fiber_contexts[i]);
+        fiber_contexts[i].uc_stack.ss_sp = stacks[i];
+        fiber_contexts[i].uc_stack.ss_size = sizeof(stacks[i]);
+        makecontext(&fiber_contexts[i], (void (*)())run_fiber, 1, i);
+    }
+
+    try
+    {
+        switch_fiber(&scheduler_context, 0);
+        switch_fiber(&scheduler_context, 0);
+        switch_fiber(&scheduler_context, 1);
+
+        assert(libexcept_get_fiber() == NULL);
+        throw(int, 3);
+    }
+    catch (int, e)
+    {
+        caught = e;
+    }
+
+    assert(fiber_caught[0] == 1);
+    assert(fiber_caught[1] == 2);
+    assert(caught == 3);
+
+    libexcept_fiber_t* previous = libexcept_swap_fiber(fibers[0]);
+    assert(previous == NULL);
+    previous = libexcept_swap_fiber(NULL);
+    assert(previous == fibers[0]);
+
+    libexcept_destroy_fiber(fibers[0]);
+    libexcept_destroy_fiber(fibers[1]);
+}
+#endif
+
+#ifdef LIBEXCEPT_STATISTICS
+typedef int counted_error_t;
+LIBEXCEPT_LOCAL_TYPE(counted_error_t);
+
+static const libexcept_type_statistics_t* find_type_statistics(
+    const libexcept_statistics_t* statistics, const libexcept_type_t* type)
+{
+    for (int i = 0; i < LIBEXCEPT_STATISTICS_TYPES; i++)
+    {
+        if (statistics->types[i].type == type)
+        {
+            return &statistics->types[i];
+        }
+    }
+    return NULL;
+}
+
+int throw_counted_errors(void* arg)
+{
+    (void)arg;
+    for (volatile int i = 0; i < 3; i++)
+    {
+        try
+        {
+            throw(counted_error_t, i);
+        }
+        catch (counted_error_t, e)
+        {
+        }
+    }
+    return 0;
+}
+
+void test_statistics()
+{
+    libexcept_statistics_t before;
+    libexcept_statistics_t after;
+    libexcept_get_statistics(&before);
+
+    try
+    {
+        try
+        {
+            try
+            {
+                throw(counted_error_t, 1);
+            }
+            catch (counted_error_t, e)
+            {
+                rethrow();
+            }
+        }
+        finally
+        {
+        }
+    }
+    catch (counted_error_t, e)
+    {
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    // Counters of exited threads are kept.
+    thrd_t thread;
+    thrd_create(&thread, throw_counted_errors, NULL);
+    thrd_join(thread, NULL);
+#else
+    throw_counted_errors(NULL);
+#endif
+
+    libexcept_get_statistics(&after);
+
+    assert(after.throws - before.throws == 4);
+    assert(after.catches - before.catches == 4);
+    assert(after.rethrows - before.rethrows == 2);
+    assert(after.max_try_depth >= 3);
+
+    const libexcept_type_statistics_t* counted =
+        find_type_statistics(&after, LIBEXCEPT_TYPE(counted_error_t));
+    assert(counted != NULL);
+    assert(find_type_statistics(&before, LIBEXCEPT_TYPE(counted_error_t)) == NULL);
+    assert(counted->throws == 4);
+    assert(counted->catches == 4);
+}
+#endif
+
+#ifdef LIBEXCEPT_BACKTRACE
+typedef int traced_error_t;
+LIBEXCEPT_LOCAL_TYPE(traced_error_t);
+
+void throw_traced_error()
+{
+    throw(traced_error_t, 0);
+}
+
+void test_backtrace()
+{
+    void* const* frames = NULL;
+    size_t count = 0;
+
+    try
+    {
+        throw_traced_error();
+    }
+    catch (traced_error_t, e)
+    {
+        count = libexcept_exception_backtrace(&frames);
+        assert(count > 0);
+
+        // Symbolization is cached.
+        const char* description = libexcept_symbolize(frames[0]);
+        assert(description != NULL);
+        assert(libexcept_symbolize(frames[0]) == description);
+    }
+
+    // Only every other throw of the same type captures a backtrace.
+    libexcept_backtrace_sampling = 2;
+    size_t captured = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        try
+        {
+            throw_traced_error();
+        }
+        catch (traced_error_t, e)
+        {
+            captured += libexcept_exception_backtrace(&frames) > 0;
+        }
+    }
+    libexcept_backtrace_sampling = 1;
+
+    assert(captured == 2);
+}
+#endif
+
+#ifdef LIBEXCEPT_RECORDER
+#include "except_recorder.h"
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+int throw_recorded_error(void* arg)
+{
+    (void)arg;
+    try
+    {
+        throw(long, 2);
+    }
+    catch (long, e)
+    {
+    }
+    return 0;
+}
+#endif
+
+void test_recorder()
+{
+    const char* path = "except_test.rec";
+    volatile int line = 0;
+
+    int started = libexcept_start_recorder(path, 2);
+    assert(started == 0);
+
+    // Threads that already claimed a ring would keep writing to the first file.
+    started = libexcept_start_recorder("except_test_again.rec", 2);
+    assert(started == -1 && errno == EBUSY);
+
+    try
+    {
+        line = __LINE__ + 1;
+        throw(int, 0x01020304);
+    }
+    catch (int, e)
+    {
+    }
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    // The ring of an exited thread keeps its entries.
+    thrd_t thread;
+    thrd_create(&thread, throw_recorded_error, NULL);
+    thrd_join(thread, NULL);
+#endif
+
+    FILE* file = fopen(path, "rb");
+    assert(file != NULL);
+    size_t size = sizeof(libexcept_recorder_header_t) + 2 * sizeof(libexcept_recorder_ring_t);
+    libexcept_recorder_header_t* header = malloc(size);
+    size_t read = fread(header, 1, size, file);
+    assert(read == size);
+    fclose(file);
+
+    assert(memcmp(header->magic, LIBEXCEPT_RECORDER_MAGIC, sizeof(header->magic)) == 0);
+    assert(header->ring_count == 2);
+
+    const libexcept_recorder_entry_t* entry = &header->rings[0].entries[0];
+    int payload = 0x01020304;
+    assert(header->rings[0].head == 1);
+    assert(entry->sequence == 1);
+    assert(strcmp(entry->type, "int") == 0);
+    assert(strcmp(entry->function, "test_recorder") == 0);
+    assert(entry->line == (uint32_t)line);
+    assert(memcmp(entry->payload, &payload, sizeof(payload)) == 0);
+
+#ifdef LIBEXCEPT_THREAD_AWARE
+    const libexcept_recorder_entry_t* other = &header->rings[1].entries[0];
+    assert(header->rings[1].owner == 0);
+    assert(strcmp(other->type, "long") == 0);
+    assert(other->thread != entry->thread);
+#endif
+
+    free(header);
+
+    // The mapping stays valid for the remaining tests once the file is unlinked.
+    int removed = remove(path);
+    assert(removed == 0);
+}
+#endif
+
+#ifdef LIBEXCEPT_UNWIND
+static void release(int** resource)
+{
+    **resource = 0;
+}
+
+static void throw_with_cleanup(int* resource)
+{
+    int* guard __attribute__((cleanup(release))) = resource;
+    throw(int, EIO);
+}
+
+void test_unwind_cleanups()
+{
+    int resource = 1;
+    int error = 0;
+
+    try
+    {
+        throw_with_cleanup(&resource);
+    }
+    catch (int, e)
+    {
+        error = e;
+    }
+
+    // Cleanups of the frames between the throw and the try block run during unwinding.
+    assert(resource == 0);
+    assert(error == EIO);
+}
+#endif
+
+#ifdef LIBEXCEPT_SIGNAL_AWARE
+#include <signal.h>
+
+// raise is declared nothrow, so calls to it would get no landing pad with the unwinder backend.
+static int (*volatile raise_signal)(int) = raise;
+
+void test_signal()
+{
+    libexcept_enable_sigcatch();
+
+    bool error_caught = false;
+    try
+    {
+        raise_signal(SIGFPE);
+    }
+    catch (arithmetic_error_t, e)
+    {
+        error_caught = true;
+    }
+
+    assert(error_caught);
+
+    libexcept_disable_sigcatch();
+}
+
+void test_signal_repeated()
+{
+    libexcept_enable_sigcatch();
+
+    // The signal must not remain blocked after the first one is turned into an exception.
+    int errors_caught = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        try
+        {
+            raise_signal(SIGSEGV);
+        }
+        catch (memory_error_t, e)
+        {
+            errors_caught++;
+        }
+    }
+
+    assert(errors_caught == 3);
+
+    sigset_t blocked;
+    sigprocmask(SIG_SETMASK, NULL, &blocked);
+    assert(!sigismember(&blocked, SIGSEGV));
+
+    libexcept_disable_sigcatch();
+}
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void test_mapped_io()
+{
+    libexcept_enable_sigcatch();
+
+    long page = sysconf(_SC_PAGESIZE);
+    char path[] = "except_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    unlink(path);
+
+    int resized = ftruncate(fd, 4 * page);
+    assert(resized == 0);
+    volatile char* data = mmap(NULL, 2 * page, PROT_READ, MAP_SHARED, fd, 2 * page);
+    assert(data != MAP_FAILED);
+    int registered = libexcept_register_mapping((const char*)data, 2 * page, fd, 2 * page);
+    assert(registered);
+
+    struct stat status;
+    fstat(fd, &status);
+
+    // Pages past the end of the file can no longer be read once it is truncated.
+    resized = ftruncate(fd, 3 * page);
+    assert(resized == 0);
+
+    off_t offset = 0;
+    try
+    {
+        (void)data[page + 5];
+    }
+    catch (mapped_io_error_t, e)
+    {
+        assert(e.address == data + page + 5);
+        assert(e.device == status.st_dev && e.inode == status.st_ino);
+        offset = e.offset;
+    }
+    catch (memory_error_t, e)
+    {
+        // Any other memory error fails the assertion below.
+    }
+    assert(offset == 3 * page + 5);
+
+    // Once unregistered the same fault is an access violation again.
+    libexcept_unregister_mapping((const char*)data);
+
+    volatile bool violated = false;
+    try
+    {
+        (void)data[page];
+    }
+    catch (memory_error_t, e)
+    {
+        violated = libexcept_exception_type() == LIBEXCEPT_TYPE(access_violation_t);
+    }
+    assert(violated);
+
+    munmap((void*)data, 2 * page);
+    close(fd);
+
+    libexcept_disable_sigcatch();
+}
+#endif
+
+#if defined(LIBEXCEPT_SIGNAL_STACKS) && defined(LIBEXCEPT_THREAD_AWARE)
+// Far deeper than any stack, but unknown to the compiler, so it can not tell that the recursion
+// never ends, nor turn it into a loop.
+static volatile int recursion_limit = 1 << 30;
+
+static __attribute__((noinline)) int recurse(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = (char)depth;
+    if (depth >= recursion_limit)
+    {
+        return frame[0];
+    }
+    return recurse(depth + 1) + frame[0];
+}
+
+// Its first store lands below the frame of its caller by more than a page.
+static __attribute__((noinline)) int recurse_far(int depth)
+{
+    volatile char frame[16 * 1024];
+    frame[0] = (char)depth;
+    if (depth >= recursion_limit)
+    {
+        return frame[0];
+    }
+    return recurse_far(depth + 1) + frame[0];
+}
+
+// Its stores only touch its own frame, so the compiler would otherwise consider it nothrow.
+static int (*volatile recurse_from)(int) = recurse;
+
+int overflow_stack(void* arg)
+{
+    (void)arg;
+    volatile int overflows = 0;
+
+    // The stack is left intact, so it can overflow again.
+    for (int i = 0; i < 2; i++)
+    {
+        try
+        {
+            recurse_from(0);
+        }
+        catch (stack_corruption_error_t, e)
+        {
+            assert(strcmp(e.message, "Stack overflow.") == 0);
+            overflows++;
+        }
+    }
+
+    return overflows;
+}
+
+void test_stack_overflow()
+{
+    libexcept_enable_sigcatch();
+
+    // A thread takes an alternate stack at its first try block and gives it back when it exits.
+    for (int i = 0; i < 2; i++)
+    {
+        int overflows = 0;
+        thrd_t thread;
+        thrd_create(&thread, overflow_stack, NULL);
+        thrd_join(thread, &overflows);
+        assert(overflows == 2);
+    }
+
+    /*
+      The main thread reports no guard page. Overflowing its stack with large frames faults anywhere
+      in the gap that the kernel keeps below it.
+     */
+    recurse_from = recurse_far;
+    assert(overflow_stack(NULL) == 2);
+    recurse_from = recurse;
+
+    libexcept_disable_sigcatch();
+}
+#endif
+
+#ifdef LIBEXCEPT_DEADLINES
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+// Reaches a safe point on every iteration, where an expired deadline is thrown.
+static void spin_for(long milliseconds)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do
+    {
+        libexcept_check();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 <
+             milliseconds);
+}
+
+void test_deadline()
+{
+    volatile int expired = 0;
+
+    try_deadline (1000000)
+    {
+        spin_for(1000);
+    }
+    catch (deadline_exceeded_t, e)
+    {
+        expired++;
+        assert(strcmp(e.message, "Deadline exceeded.") == 0);
+    }
+    assert(expired == 1);
+
+    // The earliest deadline fires and leaving its block brings back the one around it.
+    try_deadline (1000000000)
+    {
+        try_deadline (1000000)
+        {
+            try_deadline (2000000000)
+            {
+                spin_for(1000);
+            }
+        }
+        catch (deadline_exceeded_t, e)
+        {
+            expired++;
+        }
+
+        try_deadline (2000000000)
+        {
+            spin_for(1);
+        }
+    }
+    catch (deadline_exceeded_t, e)
+    {
+        assert(false);
+    }
+    assert(expired == 2);
+
+    // A blocking system call is interrupted, so that the thread gets to its next safe point.
+    int fds[2];
+    assert(pipe(fds) == 0);
+    volatile int interrupted = 0;
+    try_deadline (1000000)
+    {
+        char c;
+        interrupted = read(fds[0], &c, 1) == -1 && errno == EINTR;
+        libexcept_check();
+    }
+    catch (deadline_exceeded_t, e)
+    {
+        expired++;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    assert(interrupted);
+    assert(expired == 3);
+
+    // Nothing fires once a block has completed in time.
+    try_deadline (1000000)
+    {
+    }
+    spin_for(5);
 }
+#endif
 
 int main()
 {
     test_throw();
     test_no_throw();
+    test_type_identity();
+    test_type_hierarchy();
+    test_large_exception();
+    test_throw_site();
+    test_message();
+    test_nested_exception();
+    test_captured_exception();
+    test_checked_fp();
+    test_defer();
+#ifdef LIBEXCEPT_THREAD_AWARE
+    test_parallel_for();
+    test_task_group();
+#endif
+#ifdef LIBEXCEPT_THROW_IN
+    test_throw_in();
+#endif
+    test_subscribers();
+#ifdef LIBEXCEPT_REGIONS
+    test_regions();
+#endif
+#ifdef LIBEXCEPT_FIBERS
+    test_fibers();
+#endif
+#ifdef LIBEXCEPT_STATISTICS
+    test_statistics();
+#endif
+#ifdef LIBEXCEPT_BACKTRACE
+    test_backtrace();
+#endif
+#ifdef LIBEXCEPT_RECORDER
+    test_recorder();
+#endif
+#ifdef LIBEXCEPT_UNWIND
+    test_unwind_cleanups();
+#endif
+#ifdef LIBEXCEPT_SIGNAL_AWARE
     test_signal();
+    test_signal_repeated();
+    test_mapped_io();
+#endif
+#if defined(LIBEXCEPT_SIGNAL_STACKS) && defined(LIBEXCEPT_THREAD_AWARE)
+    test_stack_overflow();
+#endif
+#ifdef LIBEXCEPT_DEADLINES
+    test_deadline();
+#endif
 
     return 0;
 }